@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+# Benchmark driver, builds and runs the native harness and adds the Python
+# level measurements, then prints everything as one JSON document.
+#
+#   python3 bench/bench.py --backend host -o results.json
+#
+# The module must already be built in the repository root, see README.md.
+
+import argparse, json, os, platform, subprocess, sys, time
+
+benchDir = os.path.dirname(os.path.abspath(__file__))
+rootDir = os.path.dirname(benchDir)
+
+parser = argparse.ArgumentParser(description="Run the pydispmanx benchmarks and print the results as JSON")
+parser.add_argument("--backend", choices=["firmware", "host"], default=os.environ.get("PYDISPMANX_BACKEND", "firmware"), help="dispmanx implementation to build the native harness against")
+parser.add_argument("-f", "--format", action="append", default=[], help="image format for the native benchmarks, may be repeated")
+parser.add_argument("-r", "--resolution", action="append", default=[], help="WIDTHxHEIGHT for the native benchmarks, may be repeated")
+parser.add_argument("-t", "--time", type=float, default=0.25, help="minimum run time of each throughput benchmark in seconds")
+parser.add_argument("-n", "--samples", type=int, default=60, help="number of update latency samples")
+parser.add_argument("--exports", type=int, default=100000, help="number of buffer exports to time")
+parser.add_argument("-o", "--output", help="write the results to this file instead of stdout")
+args = parser.parse_args()
+
+# native harness
+subprocess.check_call(["make", "-s", "-C", benchDir, "BACKEND=" + args.backend], stdout=sys.stderr)
+command = [os.path.join(benchDir, "benchLayer-" + args.backend), "-t", str(args.time), "-n", str(args.samples)]
+for imageFormat in args.format:
+    command += ["-f", imageFormat]
+for resolution in args.resolution:
+    command += ["-r", resolution]
+report = json.loads(subprocess.check_output(command))
+
+# python level measurements
+sys.path.insert(0, rootDir)
+import pydispmanx
+
+# the export cost depends on the strides and format the buffer describes,
+# so it is timed for a direct, a 16 bit and an indexed format, small and large
+exportFormats = ["RGBA32", "RGB565", "8BPP"]
+exportSizes = [(64, 64), (1920, 1080)]
+for imageFormat in exportFormats:
+    for size in exportSizes:
+        layer = pydispmanx.dispmanxLayer(1, format=imageFormat, size=size)
+        start = time.perf_counter()
+        for n in range(args.exports):
+            with memoryview(layer):
+                pass
+        elapsed = time.perf_counter() - start
+        report["results"].append({
+            "benchmark": "buffer_export",
+            "format": imageFormat,
+            "width": layer.size[0],
+            "height": layer.size[1],
+            "iterations": args.exports,
+            "usPerExport": elapsed * 1e6 / args.exports,
+        })
+        del layer
+
+report["backend"] = args.backend
+report["machine"] = platform.machine()
+report["python"] = platform.python_version()
+report["time"] = time.strftime("%Y-%m-%dT%H:%M:%SZ", time.gmtime())
+
+if args.output:
+    with open(args.output, "w") as output:
+        json.dump(report, output, indent=2)
+else:
+    json.dump(report, sys.stdout, indent=2)
+    print()
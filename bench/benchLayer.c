@@ -0,0 +1,360 @@
+/*  PyDispmanx provides a buffer interface to a Raspberry Pi GPU layer
+*   Copyright (C) 2020,2021  Tim Clark
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Native benchmarks for the upload, update, clear and pixel paths used by
+// the module. Results are written to stdout as a JSON document, see bench.py
+// for the driver that combines them with the Python level measurements.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "image.h"
+#include "imageLayer.h"
+
+#include "bcm_host.h"
+
+#define MAX_CONFIGS 16
+
+typedef struct {
+    int32_t width;
+    int32_t height;
+} resolution;
+
+static const char *defaultFormats[] = {"RGBA32", "RGB565", "RGBA16", "8BPP"};
+static const resolution defaultResolutions[] = {{640, 480}, {1280, 720}, {1920, 1080}};
+
+static double minSeconds = 0.25;
+static int latencySamples = 60;
+static bool firstResult = true;
+
+static double now (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compareDouble (const void *a, const void *b) {
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+    return (da > db) - (da < db);
+}
+
+// start a result object, the caller adds the measurements and closes it
+static void beginResult (const char *benchmark, const IMAGE_TYPE_INFO_T *typeInfo, const IMAGE_T *image) {
+    printf ("%s\n    {\"benchmark\": \"%s\", \"format\": \"%s\", \"width\": %d, \"height\": %d",
+            firstResult ? "" : ",", benchmark, typeInfo->name, image->width, image->height);
+    firstResult = false;
+}
+
+// full frame uploads into a resource
+static void benchWriteData (const IMAGE_TYPE_INFO_T *typeInfo, IMAGE_LAYER_T *il) {
+    IMAGE_T *image = &il->image;
+    int iterations = 0;
+    double start = now ();
+    double elapsed;
+    do {
+        vc_dispmanx_resource_write_data (il->resources[0], image->type, image->pitch, image->buffer, &il->bmpRect);
+        iterations++;
+        elapsed = now () - start;
+    } while (elapsed < minSeconds);
+    double bytes = (double) image->pitch * image->height * iterations;
+    beginResult ("write_data", typeInfo, image);
+    printf (", \"iterations\": %d, \"msPerFrame\": %.4f, \"mbPerSecond\": %.2f}",
+            iterations, elapsed * 1e3 / iterations, bytes / elapsed / 1e6);
+}
+
+// time from submit to the update being on screen, with a one row upload so the transfer does not dominate
+static void benchSubmit (const IMAGE_TYPE_INFO_T *typeInfo, IMAGE_LAYER_T *il) {
+    double *latency = malloc (latencySamples * sizeof (double));
+    if (latency == NULL) {
+        return;
+    }
+    VC_RECT_T row;
+    vc_dispmanx_rect_set (&row, 0, 0, il->image.width, 1);
+    for (int i = 0; i < latencySamples; i++) {
+        DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start (0);
+        markDirtyImageLayer (il, &row);
+        changeSourceImageLayer (il, update);
+        double start = now ();
+        submitUpdateImageLayer (il, update, true);
+        latency[i] = (now () - start) * 1e6;
+    }
+    qsort (latency, latencySamples, sizeof (double), compareDouble);
+    beginResult ("update_submit", typeInfo, &il->image);
+    printf (", \"samples\": %d, \"p50Us\": %.1f, \"p90Us\": %.1f, \"p99Us\": %.1f, \"maxUs\": %.1f}",
+            latencySamples,
+            latency[(latencySamples - 1) / 2],
+            latency[(latencySamples - 1) * 9 / 10],
+            latency[(latencySamples - 1) * 99 / 100],
+            latency[latencySamples - 1]);
+    free (latency);
+}
+
+// cost to the drawing thread of handing full frames to a pipelined layer's upload thread
+static void benchPublish (const IMAGE_TYPE_INFO_T *typeInfo, IMAGE_LAYER_T *il) {
+    if (!startPipelineImageLayer (il)) {
+        return;
+    }
+    IMAGE_LAYER_STATS_T before, after;
+    getStatsImageLayer (il, &before);
+    int iterations = 0;
+    double start = now ();
+    double elapsed;
+    do {
+        publishImageLayer (il);
+        iterations++;
+        elapsed = now () - start;
+    } while (elapsed < minSeconds);
+    stopPipelineImageLayer (il);
+    waitForUpdatesImageLayer (il, 0);
+    getStatsImageLayer (il, &after);
+    beginResult ("pipeline_publish", typeInfo, &il->image);
+    printf (", \"iterations\": %d, \"usPerPublish\": %.2f, \"framesPresented\": %llu, \"framesSkipped\": %llu}",
+            iterations, elapsed * 1e6 / iterations,
+            (unsigned long long) (after.framesPresented - before.framesPresented),
+            (unsigned long long) (after.framesSkipped - before.framesSkipped));
+}
+
+// hashing a whole unchanged frame, the cost change detection adds to every update
+static void benchDetect (const IMAGE_TYPE_INFO_T *typeInfo, IMAGE_LAYER_T *il) {
+    if (!detectChangesImageLayer (il, true)) {
+        return;
+    }
+    // the first pass hashes every block and finds them all changed
+    findChangesImageLayer (il);
+    il->dirtyBands = 0;
+    int iterations = 0;
+    double start = now ();
+    double elapsed;
+    do {
+        findChangesImageLayer (il);
+        iterations++;
+        elapsed = now () - start;
+    } while (elapsed < minSeconds);
+    detectChangesImageLayer (il, false);
+    double bytes = (double) il->image.pitch * il->image.height * iterations;
+    beginResult ("detect_changes", typeInfo, &il->image);
+    printf (", \"iterations\": %d, \"msPerFrame\": %.4f, \"mbPerSecond\": %.2f}",
+            iterations, elapsed * 1e3 / iterations, bytes / elapsed / 1e6);
+}
+
+// full frame uploads copied by the GPU from a shared memory buffer, compare with write_data
+static void benchWriteShared (const IMAGE_TYPE_INFO_T *typeInfo, IMAGE_LAYER_T *il) {
+    if (!shareImageLayer (il)) {
+        return;
+    }
+    IMAGE_T *image = &il->image;
+    int iterations = 0;
+    double start = now ();
+    double elapsed;
+    do {
+        vc_dispmanx_resource_write_data_handle (il->resources[0], image->type, image->pitch, il->sharedVcHandle, 0, &il->bmpRect);
+        iterations++;
+        elapsed = now () - start;
+    } while (elapsed < minSeconds);
+    double bytes = (double) image->pitch * image->height * iterations;
+    beginResult ("write_data_shared", typeInfo, image);
+    printf (", \"iterations\": %d, \"msPerFrame\": %.4f, \"mbPerSecond\": %.2f}",
+            iterations, elapsed * 1e3 / iterations, bytes / elapsed / 1e6);
+}
+
+// whole image clears through clearImageRGB or clearImageIndexed
+static void benchClear (const IMAGE_TYPE_INFO_T *typeInfo, IMAGE_T *image) {
+    RGBA8_T colour = {0x12, 0x34, 0x56, 0x78};
+    int iterations = 0;
+    double start = now ();
+    double elapsed;
+    do {
+        if (typeInfo->isIndexed) {
+            clearImageIndexed (image, iterations & 0x0F);
+        } else {
+            colour.red = iterations;
+            clearImageRGB (image, &colour);
+        }
+        iterations++;
+        elapsed = now () - start;
+    } while (elapsed < minSeconds);
+    double pixels = (double) image->width * image->height * iterations;
+    beginResult (typeInfo->isIndexed ? "clearImageIndexed" : "clearImageRGB", typeInfo, image);
+    printf (", \"iterations\": %d, \"msPerFrame\": %.4f, \"mpixelsPerSecond\": %.2f, \"mbPerSecond\": %.2f}",
+            iterations, elapsed * 1e3 / iterations, pixels / elapsed / 1e6,
+            (double) image->pitch * image->height * iterations / elapsed / 1e6);
+}
+
+// cost of one pixel written through the setPixelDirect or setPixelIndexed pointer
+static void benchSetPixel (const IMAGE_TYPE_INFO_T *typeInfo, IMAGE_T *image) {
+    RGBA8_T colour = {0x12, 0x34, 0x56, 0x78};
+    int iterations = 0;
+    double start = now ();
+    double elapsed;
+    do {
+        for (int32_t y = 0; y < image->height; y++) {
+            for (int32_t x = 0; x < image->width; x++) {
+                if (typeInfo->isIndexed) {
+                    image->setPixelIndexed (image, x, y, x & 0x0F);
+                } else {
+                    image->setPixelDirect (image, x, y, &colour);
+                }
+            }
+        }
+        iterations++;
+        elapsed = now () - start;
+    } while (elapsed < minSeconds);
+    double pixels = (double) image->width * image->height * iterations;
+    beginResult (typeInfo->isIndexed ? "setPixelIndexed" : "setPixelDirect", typeInfo, image);
+    printf (", \"iterations\": %d, \"nsPerPixel\": %.3f}", iterations, elapsed * 1e9 / pixels);
+}
+
+// RGBA32 to RGB565 or RGBA16 row conversion as done for layers with a reduced colour upload
+static void benchConvert (const IMAGE_TYPE_INFO_T *typeInfo, IMAGE_T *image) {
+    IMAGE_T source;
+    if (!initImage (&source, VC_IMAGE_RGBA32, image->width, image->height, false)) {
+        return;
+    }
+    IMAGE_T dithered;
+    if (!initImage (&dithered, image->type, image->width, image->height, true)) {
+        destroyImage (&source);
+        return;
+    }
+    for (int32_t i = 0; i < source.pitch * source.height; i++) {
+        ((uint8_t *) source.buffer)[i] = i * 7;
+    }
+    int iterations = 0;
+    double start = now ();
+    double elapsed;
+    do {
+        convertImageRows (&dithered, &source, 0, source.height);
+        iterations++;
+        elapsed = now () - start;
+    } while (elapsed < minSeconds);
+    double pixels = (double) image->width * image->height * iterations;
+    beginResult ("convertImageRows", typeInfo, image);
+    printf (", \"iterations\": %d, \"msPerFrame\": %.4f, \"mpixelsPerSecond\": %.2f}",
+            iterations, elapsed * 1e3 / iterations, pixels / elapsed / 1e6);
+    destroyImage (&dithered);
+    destroyImage (&source);
+}
+
+static void usage (const char *program) {
+    fprintf (stderr, "usage: %s [-f FORMAT]... [-r WIDTHxHEIGHT]... [-t SECONDS] [-n SAMPLES]\n", program);
+    fprintf (stderr, "    -f  image format, default RGBA32 RGB565 RGBA16 8BPP, one of:");
+    printImageTypes (stderr, " ", "", IMAGE_TYPES_ALL);
+    fprintf (stderr, "\n    -r  resolution, default 640x480 1280x720 1920x1080\n");
+    fprintf (stderr, "    -t  minimum run time of each throughput benchmark, default %.2f\n", minSeconds);
+    fprintf (stderr, "    -n  update latency samples, default %d\n", latencySamples);
+}
+
+int main (int argc, char *argv[]) {
+    IMAGE_TYPE_INFO_T formats[MAX_CONFIGS];
+    resolution resolutions[MAX_CONFIGS];
+    int numFormats = 0;
+    int numResolutions = 0;
+
+    int opt;
+    while ((opt = getopt (argc, argv, "f:r:t:n:h")) != -1) {
+        switch (opt) {
+            case 'f':
+                if (numFormats == MAX_CONFIGS || !findImageType (&formats[numFormats], optarg, IMAGE_TYPES_ALL)) {
+                    fprintf (stderr, "unknown or too many formats: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                numFormats++;
+                break;
+            case 'r':
+                if (numResolutions == MAX_CONFIGS ||
+                    sscanf (optarg, "%dx%d", &resolutions[numResolutions].width, &resolutions[numResolutions].height) != 2 ||
+                    resolutions[numResolutions].width <= 0 || resolutions[numResolutions].height <= 0) {
+                    fprintf (stderr, "invalid or too many resolutions: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                numResolutions++;
+                break;
+            case 't':
+                minSeconds = atof (optarg);
+                break;
+            case 'n':
+                latencySamples = atoi (optarg);
+                if (latencySamples < 1) {
+                    latencySamples = 1;
+                }
+                break;
+            default:
+                usage (argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (numFormats == 0) {
+        for (size_t i = 0; i < sizeof (defaultFormats) / sizeof (defaultFormats[0]); i++) {
+            findImageType (&formats[numFormats++], defaultFormats[i], IMAGE_TYPES_ALL);
+        }
+    }
+    if (numResolutions == 0) {
+        numResolutions = sizeof (defaultResolutions) / sizeof (defaultResolutions[0]);
+        memcpy (resolutions, defaultResolutions, sizeof (defaultResolutions));
+    }
+
+    bcm_host_init ();
+    TV_ATTACHED_DEVICES_T devices;
+    if (vc_tv_get_attached_devices (&devices) == -1 || devices.num_attached < 1) {
+        fprintf (stderr, "no display connected\n");
+        return EXIT_FAILURE;
+    }
+    DISPMANX_DISPLAY_HANDLE_T display = vc_dispmanx_display_open (devices.display_number[0]);
+    if (display == 0) {
+        fprintf (stderr, "unable to open display %d\n", devices.display_number[0]);
+        return EXIT_FAILURE;
+    }
+    DISPMANX_MODEINFO_T info;
+    vc_dispmanx_display_get_info (display, &info);
+
+    printf ("{\n  \"display\": {\"width\": %d, \"height\": %d},\n  \"results\": [", info.width, info.height);
+    for (int r = 0; r < numResolutions; r++) {
+        for (int f = 0; f < numFormats; f++) {
+            IMAGE_LAYER_T il;
+            memset (&il, 0, sizeof (il));
+            if (!initImage (&il.image, formats[f].type, resolutions[r].width, resolutions[r].height, false)) {
+                continue;
+            }
+            // keep the benchmark layer under everything else on screen
+            createResourcesImageLayer (&il, -127, 2);
+            DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start (0);
+            addElementImageLayerOffset (&il, 0, 0, &info, display, update);
+            vc_dispmanx_update_submit_sync (update);
+
+            benchWriteData (&formats[f], &il);
+            benchSubmit (&formats[f], &il);
+            benchPublish (&formats[f], &il);
+            benchDetect (&formats[f], &il);
+            benchWriteShared (&formats[f], &il);
+            benchClear (&formats[f], &il.image);
+            benchSetPixel (&formats[f], &il.image);
+            if (formats[f].type == VC_IMAGE_RGB565 || formats[f].type == VC_IMAGE_RGBA16) {
+                benchConvert (&formats[f], &il.image);
+            }
+            fflush (stdout);
+
+            destroyImageLayer (&il);
+        }
+    }
+    printf ("\n  ]\n}\n");
+
+    vc_dispmanx_display_close (display);
+    return EXIT_SUCCESS;
+}
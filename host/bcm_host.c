@@ -0,0 +1,992 @@
+/*  PyDispmanx provides a buffer interface to a Raspberry Pi GPU layer
+*   Copyright (C) 2020,2021  Tim Clark
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// In-memory implementation of the dispmanx, tvservice and vcsm calls used by
+// the module. Resources and shared memory blocks are heap buffers, updates
+// are queued and applied at a simulated vsync and elements are composited
+// on the CPU in layer order when a frame hook is installed, so the module
+// can be built and exercised on a host without a VideoCore GPU.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "bcm_host.h"
+#include "hostDispmanx.h"
+#include "user-vcsm.h"
+#include "../element_change.h"
+
+#define DEFAULT_WIDTH 1920
+#define DEFAULT_HEIGHT 1080
+#define DEFAULT_FRAME_RATE 60
+
+// generic table mapping handles to objects, handle 0 is never used
+typedef struct {
+    void **slot;
+    uint32_t size;
+} handleTable;
+
+typedef struct {
+    VC_IMAGE_TYPE_T type;
+    int32_t width;
+    int32_t height;
+    int32_t pitch;
+    int32_t alignedHeight;
+    uint8_t *buffer;
+    uint16_t palette[256];
+} hostResource;
+
+typedef struct {
+    uint8_t *buffer;
+    uint32_t size;
+    uint32_t locks;
+} hostSharedBlock;
+
+typedef struct {
+    bool visible;
+    DISPMANX_DISPLAY_HANDLE_T display;
+    int32_t layer;
+    VC_RECT_T dstRect;
+    VC_RECT_T srcRect;
+    DISPMANX_RESOURCE_HANDLE_T resource;
+    DISPMANX_FLAGS_ALPHA_T alphaFlags;
+    uint8_t opacity;
+    DISPMANX_TRANSFORM_T transform;
+} hostElement;
+
+typedef enum {
+    OP_ADD,
+    OP_CHANGE_SOURCE,
+    OP_CHANGE_ATTRIBUTES,
+    OP_REMOVE
+} hostOpType;
+
+typedef struct {
+    hostOpType type;
+    DISPMANX_ELEMENT_HANDLE_T element;
+    uint32_t changeFlags;
+    hostElement state;
+} hostOp;
+
+typedef struct hostUpdate_ hostUpdate;
+
+struct hostUpdate_ {
+    hostOp *op;
+    uint32_t ops;
+    uint32_t capacity;
+    DISPMANX_CALLBACK_FUNC_T callback;
+    void *callbackArg;
+    DISPMANX_UPDATE_HANDLE_T handle;
+    hostUpdate *next;
+};
+
+// everything below is protected by hostLock
+static pthread_mutex_t hostLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hostModeChanged = PTHREAD_COND_INITIALIZER;
+static pthread_once_t hostOnce = PTHREAD_ONCE_INIT;
+
+static int32_t hostWidth = DEFAULT_WIDTH;
+static int32_t hostHeight = DEFAULT_HEIGHT;
+static int32_t hostFrameRate = DEFAULT_FRAME_RATE;
+static uint32_t hostDisplaysOpen = 0;
+
+static handleTable resources;
+static handleTable elements;
+static handleTable updates;
+static handleTable sharedBlocks;
+
+// submitted updates waiting for the next vsync
+static hostUpdate *queueHead = NULL;
+static hostUpdate *queueTail = NULL;
+
+static uint64_t hostFrame = 0;
+static uint8_t *frameBuffer = NULL;
+static HOST_DISPMANX_FRAME_CALLBACK_T frameCallback = NULL;
+static void *frameCallbackArg = NULL;
+static DISPMANX_CALLBACK_FUNC_T vsyncCallback = NULL;
+static void *vsyncCallbackArg = NULL;
+
+#define MAX_TV_CALLBACKS 8
+
+static TVSERVICE_CALLBACK_T tvCallback[MAX_TV_CALLBACKS];
+static void *tvCallbackData[MAX_TV_CALLBACKS];
+static const char *dumpPattern = NULL;
+
+// add an object to a table returning its handle, 0 if out of memory
+static uint32_t allocHandle (handleTable *table, void *object) {
+    uint32_t i;
+    for (i = 0; i < table->size; i++) {
+        if (table->slot[i] == NULL) {
+            table->slot[i] = object;
+            return i + 1;
+        }
+    }
+    uint32_t size = table->size ? table->size * 2 : 16;
+    void **slot = realloc (table->slot, size * sizeof (void *));
+    if (slot == NULL) {
+        return 0;
+    }
+    memset (slot + table->size, 0, (size - table->size) * sizeof (void *));
+    table->slot = slot;
+    table->size = size;
+    table->slot[i] = object;
+    return i + 1;
+}
+
+static void *lookupHandle (handleTable *table, uint32_t handle) {
+    if (handle == 0 || handle > table->size) {
+        return NULL;
+    }
+    return table->slot[handle - 1];
+}
+
+static void releaseHandle (handleTable *table, uint32_t handle) {
+    if (handle != 0 && handle <= table->size) {
+        table->slot[handle - 1] = NULL;
+    }
+}
+
+static uint16_t bitsPerPixel (VC_IMAGE_TYPE_T type) {
+    switch (type) {
+        case VC_IMAGE_4BPP:
+            return 4;
+        case VC_IMAGE_8BPP:
+            return 8;
+        case VC_IMAGE_RGB565:
+        case VC_IMAGE_RGBA16:
+            return 16;
+        case VC_IMAGE_RGB888:
+            return 24;
+        case VC_IMAGE_RGBA32:
+            return 32;
+        default:
+            return 0;
+    }
+}
+
+// read the display mode from the environment
+static void hostInit (void) {
+    const char *mode = getenv ("PYDISPMANX_HOST_MODE");
+    if (mode != NULL) {
+        int width, height, frameRate = DEFAULT_FRAME_RATE;
+        if (sscanf (mode, "%dx%d@%d", &width, &height, &frameRate) >= 2 && width > 0 && height > 0 && frameRate >= 0) {
+            hostWidth = width;
+            hostHeight = height;
+            hostFrameRate = frameRate;
+        } else {
+            fprintf (stderr, "host dispmanx: ignoring invalid PYDISPMANX_HOST_MODE \"%s\"\n", mode);
+        }
+    }
+    dumpPattern = getenv ("PYDISPMANX_HOST_DUMP");
+}
+
+// convert one source pixel to RGBA
+static void readPixel (const hostResource *resource, int32_t x, int32_t y, uint8_t *rgba) {
+    const uint8_t *line = resource->buffer + y * resource->pitch;
+    uint16_t pixel;
+    switch (resource->type) {
+        case VC_IMAGE_RGBA32:
+            memcpy (rgba, line + x * 4, 4);
+            break;
+        case VC_IMAGE_RGB888:
+            memcpy (rgba, line + x * 3, 3);
+            rgba[3] = 255;
+            break;
+        case VC_IMAGE_RGB565:
+            memcpy (&pixel, line + x * 2, 2);
+            rgba[0] = ((pixel >> 11) & 0x1F) * 255 / 31;
+            rgba[1] = ((pixel >> 5) & 0x3F) * 255 / 63;
+            rgba[2] = (pixel & 0x1F) * 255 / 31;
+            rgba[3] = 255;
+            break;
+        case VC_IMAGE_RGBA16:
+            memcpy (&pixel, line + x * 2, 2);
+            rgba[0] = ((pixel >> 12) & 0xF) * 17;
+            rgba[1] = ((pixel >> 8) & 0xF) * 17;
+            rgba[2] = ((pixel >> 4) & 0xF) * 17;
+            rgba[3] = (pixel & 0xF) * 17;
+            break;
+        case VC_IMAGE_8BPP:
+        case VC_IMAGE_4BPP:
+            // indexed pixels are looked up in the RGB565 palette
+            if (resource->type == VC_IMAGE_8BPP) {
+                pixel = resource->palette[line[x]];
+            } else {
+                pixel = resource->palette[(x % 2) ? (line[x / 2] & 0x0F) : (line[x / 2] >> 4)];
+            }
+            rgba[0] = ((pixel >> 11) & 0x1F) * 255 / 31;
+            rgba[1] = ((pixel >> 5) & 0x3F) * 255 / 63;
+            rgba[2] = (pixel & 0x1F) * 255 / 31;
+            rgba[3] = 255;
+            break;
+        default:
+            memset (rgba, 0, 4);
+            break;
+    }
+}
+
+// blend one element into the frame buffer, the source is flipped and then
+// rotated clockwise by the element transform
+static void compositeElement (const hostElement *element) {
+    const hostResource *resource = lookupHandle (&resources, element->resource);
+    const VC_RECT_T *dst = &element->dstRect;
+    const VC_RECT_T *src = &element->srcRect;
+    if (resource == NULL || dst->width <= 0 || dst->height <= 0) {
+        return;
+    }
+    uint32_t rotation = element->transform & 3;
+    bool flipH = (element->transform & DISPMANX_FLIP_HRIZ) != 0;
+    bool flipV = (element->transform & DISPMANX_FLIP_VERT) != 0;
+    // size of the flipped source as it lands in dst before rotating
+    int32_t across = (rotation % 2) ? dst->height : dst->width;
+    int32_t down = (rotation % 2) ? dst->width : dst->height;
+    int32_t left = dst->x < 0 ? 0 : dst->x;
+    int32_t top = dst->y < 0 ? 0 : dst->y;
+    int32_t right = dst->x + dst->width > hostWidth ? hostWidth : dst->x + dst->width;
+    int32_t bottom = dst->y + dst->height > hostHeight ? hostHeight : dst->y + dst->height;
+    for (int32_t y = top; y < bottom; y++) {
+        uint8_t *out = frameBuffer + (y * hostWidth + left) * 4;
+        for (int32_t x = left; x < right; x++, out += 4) {
+            int32_t u = x - dst->x, v = y - dst->y, a, b;
+            switch (rotation) {
+                case DISPMANX_ROTATE_90:
+                    a = v;
+                    b = dst->width - 1 - u;
+                    break;
+                case DISPMANX_ROTATE_180:
+                    a = dst->width - 1 - u;
+                    b = dst->height - 1 - v;
+                    break;
+                case DISPMANX_ROTATE_270:
+                    a = dst->height - 1 - v;
+                    b = u;
+                    break;
+                default:
+                    a = u;
+                    b = v;
+                    break;
+            }
+            if (flipH) {
+                a = across - 1 - a;
+            }
+            if (flipV) {
+                b = down - 1 - b;
+            }
+            // source rect is 16.16 fixed point
+            int32_t sx = (src->x + (int64_t) a * src->width / across) >> 16;
+            int32_t sy = (src->y + (int64_t) b * src->height / down) >> 16;
+            if (sx < 0 || sx >= resource->width || sy < 0 || sy >= resource->height) {
+                continue;
+            }
+            uint8_t rgba[4];
+            readPixel (resource, sx, sy, rgba);
+            uint32_t alpha;
+            if ((element->alphaFlags & 0xFFFF) == DISPMANX_FLAGS_ALPHA_FIXED_ALL_PIXELS) {
+                alpha = element->opacity;
+            } else {
+                alpha = rgba[3] * element->opacity / 255;
+            }
+            for (int c = 0; c < 3; c++) {
+                out[c] = (rgba[c] * alpha + out[c] * (255 - alpha)) / 255;
+            }
+            out[3] = 255;
+        }
+    }
+}
+
+static int compareLayer (const void *a, const void *b) {
+    const hostElement *ea = *(const hostElement * const *) a;
+    const hostElement *eb = *(const hostElement * const *) b;
+    return (ea->layer > eb->layer) - (ea->layer < eb->layer);
+}
+
+static void dumpFrame (void) {
+    char path[4096];
+    snprintf (path, sizeof (path), dumpPattern, (int) hostFrame);
+    FILE *fp = fopen (path, "wb");
+    if (fp == NULL) {
+        return;
+    }
+    fprintf (fp, "P6\n%d %d\n255\n", hostWidth, hostHeight);
+    for (int32_t i = 0; i < hostWidth * hostHeight; i++) {
+        fwrite (frameBuffer + i * 4, 3, 1, fp);
+    }
+    fclose (fp);
+}
+
+// draw every visible element bottom layer first
+static void compositeLocked (void) {
+    if (frameCallback == NULL && dumpPattern == NULL) {
+        return;
+    }
+    if (frameBuffer == NULL) {
+        frameBuffer = malloc ((size_t) hostWidth * hostHeight * 4);
+        if (frameBuffer == NULL) {
+            return;
+        }
+    }
+    memset (frameBuffer, 0, (size_t) hostWidth * hostHeight * 4);
+
+    hostElement **visible = malloc (elements.size * sizeof (hostElement *) + 1);
+    if (visible == NULL) {
+        return;
+    }
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < elements.size; i++) {
+        hostElement *element = elements.slot[i];
+        if (element != NULL && element->visible) {
+            visible[count++] = element;
+        }
+    }
+    qsort (visible, count, sizeof (hostElement *), compareLayer);
+    for (uint32_t i = 0; i < count; i++) {
+        compositeElement (visible[i]);
+    }
+    free (visible);
+
+    if (dumpPattern != NULL) {
+        dumpFrame ();
+    }
+    if (frameCallback != NULL) {
+        frameCallback (frameBuffer, hostWidth, hostHeight, hostWidth * 4, hostFrame, frameCallbackArg);
+    }
+}
+
+static void applyUpdateLocked (hostUpdate *update) {
+    for (uint32_t i = 0; i < update->ops; i++) {
+        hostOp *op = &update->op[i];
+        hostElement *element = lookupHandle (&elements, op->element);
+        if (element == NULL) {
+            continue;
+        }
+        switch (op->type) {
+            case OP_ADD:
+                *element = op->state;
+                element->visible = true;
+                break;
+            case OP_CHANGE_SOURCE:
+                element->resource = op->state.resource;
+                break;
+            case OP_CHANGE_ATTRIBUTES:
+                if (op->changeFlags & ELEMENT_CHANGE_LAYER) {
+                    element->layer = op->state.layer;
+                }
+                if (op->changeFlags & ELEMENT_CHANGE_OPACITY) {
+                    element->opacity = op->state.opacity;
+                }
+                if (op->changeFlags & ELEMENT_CHANGE_DEST_RECT) {
+                    element->dstRect = op->state.dstRect;
+                }
+                if (op->changeFlags & ELEMENT_CHANGE_SRC_RECT) {
+                    element->srcRect = op->state.srcRect;
+                }
+                if (op->changeFlags & ELEMENT_CHANGE_TRANSFORM) {
+                    element->transform = op->state.transform;
+                }
+                break;
+            case OP_REMOVE:
+                releaseHandle (&elements, op->element);
+                free (element);
+                break;
+        }
+    }
+}
+
+// apply everything queued, then run the completion callbacks without the lock held
+static void vsyncLocked (void) {
+    hostUpdate *update = queueHead;
+    queueHead = queueTail = NULL;
+    for (hostUpdate *u = update; u != NULL; u = u->next) {
+        applyUpdateLocked (u);
+    }
+    hostFrame++;
+    compositeLocked ();
+    DISPMANX_CALLBACK_FUNC_T vsync = vsyncCallback;
+    void *vsyncArg = vsyncCallbackArg;
+
+    pthread_mutex_unlock (&hostLock);
+    if (vsync != NULL) {
+        vsync (DISPMANX_NO_HANDLE, vsyncArg);
+    }
+    while (update != NULL) {
+        hostUpdate *next = update->next;
+        if (update->callback != NULL) {
+            update->callback (update->handle, update->callbackArg);
+        }
+        free (update->op);
+        free (update);
+        update = next;
+    }
+    pthread_mutex_lock (&hostLock);
+}
+
+static void *vsyncThread (void *arg) {
+    struct timespec next;
+    clock_gettime (CLOCK_MONOTONIC, &next);
+    pthread_mutex_lock (&hostLock);
+    while (true) {
+        while (hostFrameRate <= 0) {
+            pthread_cond_wait (&hostModeChanged, &hostLock);
+            clock_gettime (CLOCK_MONOTONIC, &next);
+        }
+        long period = 1000000000L / hostFrameRate;
+        next.tv_nsec += period;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        pthread_mutex_unlock (&hostLock);
+        clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        pthread_mutex_lock (&hostLock);
+
+        // drop missed ticks rather than running a burst of them
+        struct timespec now;
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - next.tv_sec) * 1000000000L + (now.tv_nsec - next.tv_nsec) > period) {
+            next = now;
+        }
+        vsyncLocked ();
+    }
+    return NULL;
+}
+
+static void hostStart (void) {
+    pthread_t thread;
+    hostInit ();
+    if (pthread_create (&thread, NULL, vsyncThread, NULL) == 0) {
+        pthread_detach (thread);
+    } else {
+        fprintf (stderr, "host dispmanx: unable to start vsync thread, applying updates immediately\n");
+        hostFrameRate = 0;
+    }
+}
+
+bool hostDispmanxSetMode (int32_t width, int32_t height, int32_t frameRate) {
+    bool changed = false;
+    pthread_once (&hostOnce, hostStart);
+    pthread_mutex_lock (&hostLock);
+    if (hostDisplaysOpen == 0 && width > 0 && height > 0 && frameRate >= 0) {
+        hostWidth = width;
+        hostHeight = height;
+        hostFrameRate = frameRate;
+        free (frameBuffer);
+        frameBuffer = NULL;
+        pthread_cond_broadcast (&hostModeChanged);
+        changed = true;
+    }
+    TVSERVICE_CALLBACK_T callback[MAX_TV_CALLBACKS];
+    void *callbackData[MAX_TV_CALLBACKS];
+    memcpy (callback, tvCallback, sizeof (callback));
+    memcpy (callbackData, tvCallbackData, sizeof (callbackData));
+    pthread_mutex_unlock (&hostLock);
+    for (int i = 0; changed && i < MAX_TV_CALLBACKS; i++) {
+        if (callback[i] != NULL) {
+            callback[i] (callbackData[i], VC_HDMI_HDMI, 0, 0);
+        }
+    }
+    return changed;
+}
+
+void hostDispmanxSetFrameCallback (HOST_DISPMANX_FRAME_CALLBACK_T callback, void *arg) {
+    pthread_mutex_lock (&hostLock);
+    frameCallback = callback;
+    frameCallbackArg = arg;
+    pthread_mutex_unlock (&hostLock);
+}
+
+// bcm_host
+
+void bcm_host_init (void) {
+    pthread_once (&hostOnce, hostStart);
+}
+
+void bcm_host_deinit (void) {
+}
+
+// dispmanx
+
+int vc_dispmanx_rect_set (VC_RECT_T *rect, uint32_t x_offset, uint32_t y_offset, uint32_t width, uint32_t height) {
+    rect->x = x_offset;
+    rect->y = y_offset;
+    rect->width = width;
+    rect->height = height;
+    return 0;
+}
+
+DISPMANX_DISPLAY_HANDLE_T vc_dispmanx_display_open (uint32_t device) {
+    if (device != HOST_DISPMANX_DISPLAY_ID) {
+        return DISPMANX_NO_HANDLE;
+    }
+    bcm_host_init ();
+    pthread_mutex_lock (&hostLock);
+    hostDisplaysOpen++;
+    pthread_mutex_unlock (&hostLock);
+    return 1;
+}
+
+int vc_dispmanx_display_close (DISPMANX_DISPLAY_HANDLE_T display) {
+    if (display != 1) {
+        return -1;
+    }
+    pthread_mutex_lock (&hostLock);
+    hostDisplaysOpen--;
+    pthread_mutex_unlock (&hostLock);
+    return 0;
+}
+
+int vc_dispmanx_display_get_info (DISPMANX_DISPLAY_HANDLE_T display, DISPMANX_MODEINFO_T *pinfo) {
+    if (display != 1) {
+        return -1;
+    }
+    pthread_mutex_lock (&hostLock);
+    pinfo->width = hostWidth;
+    pinfo->height = hostHeight;
+    pthread_mutex_unlock (&hostLock);
+    pinfo->transform = DISPMANX_NO_ROTATE;
+    pinfo->input_format = DISPLAY_INPUT_FORMAT_RGB888;
+    pinfo->display_num = HOST_DISPMANX_DISPLAY_ID;
+    return 0;
+}
+
+// the width and height may carry the pitch and aligned height in their top 16 bits
+DISPMANX_RESOURCE_HANDLE_T vc_dispmanx_resource_create (VC_IMAGE_TYPE_T type, uint32_t width, uint32_t height, uint32_t *native_image_handle) {
+    uint16_t bpp = bitsPerPixel (type);
+    if (bpp == 0 || (width & 0xFFFF) == 0 || (height & 0xFFFF) == 0) {
+        return DISPMANX_NO_HANDLE;
+    }
+    hostResource *resource = calloc (1, sizeof (hostResource));
+    if (resource == NULL) {
+        return DISPMANX_NO_HANDLE;
+    }
+    resource->type = type;
+    resource->width = width & 0xFFFF;
+    resource->height = height & 0xFFFF;
+    resource->pitch = width >> 16;
+    if (resource->pitch == 0) {
+        resource->pitch = ((resource->width * bpp + 7) / 8 + 31) & ~31;
+    }
+    resource->alignedHeight = height >> 16;
+    if (resource->alignedHeight < resource->height) {
+        resource->alignedHeight = resource->height;
+    }
+    resource->buffer = calloc (resource->alignedHeight, resource->pitch);
+    if (resource->buffer == NULL) {
+        free (resource);
+        return DISPMANX_NO_HANDLE;
+    }
+    // indexed resources start with a grey ramp until a palette is set
+    int32_t entries = type == VC_IMAGE_4BPP ? 16 : 256;
+    for (int32_t i = 0; i < entries; i++) {
+        uint32_t grey = i * 255 / (entries - 1);
+        resource->palette[i] = ((grey >> 3) << 11) | ((grey >> 2) << 5) | (grey >> 3);
+    }
+
+    pthread_mutex_lock (&hostLock);
+    DISPMANX_RESOURCE_HANDLE_T handle = allocHandle (&resources, resource);
+    pthread_mutex_unlock (&hostLock);
+    if (handle == DISPMANX_NO_HANDLE) {
+        free (resource->buffer);
+        free (resource);
+    }
+    if (native_image_handle != NULL) {
+        *native_image_handle = handle;
+    }
+    return handle;
+}
+
+// like the firmware the x coordinate and width of the rect are ignored and whole rows are copied
+int vc_dispmanx_resource_write_data (DISPMANX_RESOURCE_HANDLE_T res, VC_IMAGE_TYPE_T src_type, int src_pitch, void *src_address, const VC_RECT_T *rect) {
+    if (src_address == NULL || rect == NULL || src_pitch <= 0) {
+        return -1;
+    }
+    pthread_mutex_lock (&hostLock);
+    hostResource *resource = lookupHandle (&resources, res);
+    if (resource == NULL || rect->y < 0 || rect->height < 0 || rect->y + rect->height > resource->alignedHeight) {
+        pthread_mutex_unlock (&hostLock);
+        return -1;
+    }
+    const uint8_t *src = (const uint8_t *) src_address + (size_t) src_pitch * rect->y;
+    uint8_t *dst = resource->buffer + (size_t) resource->pitch * rect->y;
+    if (src_pitch == resource->pitch) {
+        memcpy (dst, src, (size_t) src_pitch * rect->height);
+    } else {
+        int32_t bytes = src_pitch < resource->pitch ? src_pitch : resource->pitch;
+        for (int32_t row = 0; row < rect->height; row++) {
+            memcpy (dst + (size_t) row * resource->pitch, src + (size_t) row * src_pitch, bytes);
+        }
+    }
+    pthread_mutex_unlock (&hostLock);
+    return 0;
+}
+
+// the source is a vcsm block, the handle is the same as the user handle
+int vc_dispmanx_resource_write_data_handle (DISPMANX_RESOURCE_HANDLE_T res, VC_IMAGE_TYPE_T src_type, int src_pitch, VCHI_MEM_HANDLE_T handle, uint32_t offset, const VC_RECT_T *rect) {
+    if (rect == NULL || src_pitch <= 0 || rect->y < 0 || rect->height < 0) {
+        return -1;
+    }
+    pthread_mutex_lock (&hostLock);
+    hostSharedBlock *block = lookupHandle (&sharedBlocks, (uint32_t) handle);
+    uint8_t *address = NULL;
+    if (block != NULL && (uint64_t) offset + (uint64_t) src_pitch * (rect->y + rect->height) <= block->size) {
+        address = block->buffer + offset;
+    }
+    pthread_mutex_unlock (&hostLock);
+    if (address == NULL) {
+        return -1;
+    }
+    return vc_dispmanx_resource_write_data (res, src_type, src_pitch, address, rect);
+}
+
+// the palette holds RGB565 entries, offset and size are in bytes
+int vc_dispmanx_resource_set_palette (DISPMANX_RESOURCE_HANDLE_T handle, void *src_address, int offset, int size) {
+    if (src_address == NULL || offset < 0 || size < 0 || offset % 2 != 0 || size % 2 != 0) {
+        return -1;
+    }
+    pthread_mutex_lock (&hostLock);
+    hostResource *resource = lookupHandle (&resources, handle);
+    if (resource == NULL || (resource->type != VC_IMAGE_8BPP && resource->type != VC_IMAGE_4BPP) ||
+        offset + size > (int) sizeof (resource->palette)) {
+        pthread_mutex_unlock (&hostLock);
+        return -1;
+    }
+    memcpy ((uint8_t *) resource->palette + offset, src_address, size);
+    pthread_mutex_unlock (&hostLock);
+    return 0;
+}
+
+int vc_dispmanx_resource_delete (DISPMANX_RESOURCE_HANDLE_T res) {
+    pthread_mutex_lock (&hostLock);
+    hostResource *resource = lookupHandle (&resources, res);
+    releaseHandle (&resources, res);
+    pthread_mutex_unlock (&hostLock);
+    if (resource == NULL) {
+        return -1;
+    }
+    free (resource->buffer);
+    free (resource);
+    return 0;
+}
+
+DISPMANX_UPDATE_HANDLE_T vc_dispmanx_update_start (int32_t priority) {
+    hostUpdate *update = calloc (1, sizeof (hostUpdate));
+    if (update == NULL) {
+        return DISPMANX_NO_HANDLE;
+    }
+    pthread_mutex_lock (&hostLock);
+    DISPMANX_UPDATE_HANDLE_T handle = allocHandle (&updates, update);
+    update->handle = handle;
+    pthread_mutex_unlock (&hostLock);
+    if (handle == DISPMANX_NO_HANDLE) {
+        free (update);
+    }
+    return handle;
+}
+
+// append an operation to an update that has not been submitted yet
+static hostOp *addOp (DISPMANX_UPDATE_HANDLE_T handle, hostOpType type, DISPMANX_ELEMENT_HANDLE_T element) {
+    pthread_mutex_lock (&hostLock);
+    hostUpdate *update = lookupHandle (&updates, handle);
+    pthread_mutex_unlock (&hostLock);
+    if (update == NULL) {
+        return NULL;
+    }
+    if (update->ops == update->capacity) {
+        uint32_t capacity = update->capacity ? update->capacity * 2 : 8;
+        hostOp *op = realloc (update->op, capacity * sizeof (hostOp));
+        if (op == NULL) {
+            return NULL;
+        }
+        update->op = op;
+        update->capacity = capacity;
+    }
+    hostOp *op = &update->op[update->ops++];
+    memset (op, 0, sizeof (hostOp));
+    op->type = type;
+    op->element = element;
+    return op;
+}
+
+DISPMANX_ELEMENT_HANDLE_T vc_dispmanx_element_add (DISPMANX_UPDATE_HANDLE_T update, DISPMANX_DISPLAY_HANDLE_T display, int32_t layer, const VC_RECT_T *dest_rect, DISPMANX_RESOURCE_HANDLE_T src, const VC_RECT_T *src_rect, DISPMANX_PROTECTION_T protection, VC_DISPMANX_ALPHA_T *alpha, DISPMANX_CLAMP_T *clamp, DISPMANX_TRANSFORM_T transform) {
+    if (dest_rect == NULL || src_rect == NULL) {
+        return DISPMANX_NO_HANDLE;
+    }
+    hostElement *element = calloc (1, sizeof (hostElement));
+    if (element == NULL) {
+        return DISPMANX_NO_HANDLE;
+    }
+    pthread_mutex_lock (&hostLock);
+    DISPMANX_ELEMENT_HANDLE_T handle = allocHandle (&elements, element);
+    pthread_mutex_unlock (&hostLock);
+    if (handle == DISPMANX_NO_HANDLE) {
+        free (element);
+        return DISPMANX_NO_HANDLE;
+    }
+    hostOp *op = addOp (update, OP_ADD, handle);
+    if (op == NULL) {
+        pthread_mutex_lock (&hostLock);
+        releaseHandle (&elements, handle);
+        pthread_mutex_unlock (&hostLock);
+        free (element);
+        return DISPMANX_NO_HANDLE;
+    }
+    op->state.display = display;
+    op->state.layer = layer;
+    op->state.dstRect = *dest_rect;
+    op->state.srcRect = *src_rect;
+    op->state.resource = src;
+    op->state.alphaFlags = alpha ? alpha->flags : DISPMANX_FLAGS_ALPHA_FROM_SOURCE;
+    op->state.opacity = alpha ? alpha->opacity : 255;
+    op->state.transform = transform;
+    return handle;
+}
+
+int vc_dispmanx_element_change_source (DISPMANX_UPDATE_HANDLE_T update, DISPMANX_ELEMENT_HANDLE_T element, DISPMANX_RESOURCE_HANDLE_T src) {
+    hostOp *op = addOp (update, OP_CHANGE_SOURCE, element);
+    if (op == NULL) {
+        return -1;
+    }
+    op->state.resource = src;
+    return 0;
+}
+
+int vc_dispmanx_element_change_attributes (DISPMANX_UPDATE_HANDLE_T update, DISPMANX_ELEMENT_HANDLE_T element, uint32_t change_flags, int32_t layer, uint8_t opacity, const VC_RECT_T *dest_rect, const VC_RECT_T *src_rect, DISPMANX_RESOURCE_HANDLE_T mask, DISPMANX_TRANSFORM_T transform) {
+    hostOp *op = addOp (update, OP_CHANGE_ATTRIBUTES, element);
+    if (op == NULL) {
+        return -1;
+    }
+    op->changeFlags = change_flags;
+    op->state.layer = layer;
+    op->state.opacity = opacity;
+    if (dest_rect != NULL) {
+        op->state.dstRect = *dest_rect;
+    }
+    if (src_rect != NULL) {
+        op->state.srcRect = *src_rect;
+    }
+    op->state.transform = transform;
+    return 0;
+}
+
+int vc_dispmanx_element_remove (DISPMANX_UPDATE_HANDLE_T update, DISPMANX_ELEMENT_HANDLE_T element) {
+    return addOp (update, OP_REMOVE, element) == NULL ? -1 : 0;
+}
+
+int vc_dispmanx_update_submit (DISPMANX_UPDATE_HANDLE_T handle, DISPMANX_CALLBACK_FUNC_T cb_func, void *cb_arg) {
+    pthread_mutex_lock (&hostLock);
+    hostUpdate *update = lookupHandle (&updates, handle);
+    if (update == NULL) {
+        pthread_mutex_unlock (&hostLock);
+        return -1;
+    }
+    releaseHandle (&updates, handle);
+    update->callback = cb_func;
+    update->callbackArg = cb_arg;
+    if (queueTail != NULL) {
+        queueTail->next = update;
+    } else {
+        queueHead = update;
+    }
+    queueTail = update;
+    if (hostFrameRate <= 0) {
+        vsyncLocked ();
+    }
+    pthread_mutex_unlock (&hostLock);
+    return 0;
+}
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool done;
+} syncWait;
+
+static void syncDone (DISPMANX_UPDATE_HANDLE_T update, void *arg) {
+    syncWait *wait = arg;
+    pthread_mutex_lock (&wait->lock);
+    wait->done = true;
+    pthread_cond_signal (&wait->cond);
+    pthread_mutex_unlock (&wait->lock);
+}
+
+int vc_dispmanx_update_submit_sync (DISPMANX_UPDATE_HANDLE_T update) {
+    syncWait wait = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false };
+    int result = vc_dispmanx_update_submit (update, syncDone, &wait);
+    if (result == 0) {
+        pthread_mutex_lock (&wait.lock);
+        while (!wait.done) {
+            pthread_cond_wait (&wait.cond, &wait.lock);
+        }
+        pthread_mutex_unlock (&wait.lock);
+    }
+    pthread_mutex_destroy (&wait.lock);
+    pthread_cond_destroy (&wait.cond);
+    return result;
+}
+
+// like the firmware there is a single vsync callback, replacing any earlier one, NULL stops it
+int vc_dispmanx_vsync_callback (DISPMANX_DISPLAY_HANDLE_T display, DISPMANX_CALLBACK_FUNC_T cb_func, void *cb_arg) {
+    pthread_mutex_lock (&hostLock);
+    vsyncCallback = cb_func;
+    vsyncCallbackArg = cb_arg;
+    pthread_mutex_unlock (&hostLock);
+    return 0;
+}
+
+// tvservice
+
+int vc_tv_get_attached_devices (TV_ATTACHED_DEVICES_T *devices) {
+    bcm_host_init ();
+    memset (devices, 0, sizeof (TV_ATTACHED_DEVICES_T));
+    devices->num_attached = 1;
+    devices->display_number[0] = HOST_DISPMANX_DISPLAY_ID;
+    return 0;
+}
+
+int vc_tv_get_display_state_id (uint32_t display_id, TV_DISPLAY_STATE_T *tvstate) {
+    if (display_id != HOST_DISPMANX_DISPLAY_ID) {
+        return -1;
+    }
+    memset (tvstate, 0, sizeof (TV_DISPLAY_STATE_T));
+    pthread_mutex_lock (&hostLock);
+    tvstate->state = VC_HDMI_ATTACHED | VC_HDMI_HDMI;
+    tvstate->display.hdmi.state = tvstate->state;
+    tvstate->display.hdmi.width = hostWidth;
+    tvstate->display.hdmi.height = hostHeight;
+    tvstate->display.hdmi.frame_rate = hostFrameRate;
+    // square pixels whatever the mode
+    tvstate->display.hdmi.aspect_ratio = HDMI_ASPECT_UNKNOWN;
+    pthread_mutex_unlock (&hostLock);
+    return 0;
+}
+
+int vc_tv_hdmi_get_property_id (uint32_t display_id, HDMI_PROPERTY_PARAM_T *property) {
+    if (display_id != HOST_DISPMANX_DISPLAY_ID) {
+        return -1;
+    }
+    property->param1 = 0;
+    property->param2 = 0;
+    if (property->property == HDMI_PROPERTY_PIXEL_CLOCK_TYPE) {
+        property->param1 = HDMI_PIXEL_CLOCK_TYPE_PAL;
+    }
+    return 0;
+}
+
+void vc_tv_register_callback (TVSERVICE_CALLBACK_T callback, void *callback_data) {
+    pthread_mutex_lock (&hostLock);
+    for (int i = 0; i < MAX_TV_CALLBACKS; i++) {
+        if (tvCallback[i] == NULL) {
+            tvCallback[i] = callback;
+            tvCallbackData[i] = callback_data;
+            break;
+        }
+    }
+    pthread_mutex_unlock (&hostLock);
+}
+
+void vc_tv_unregister_callback (TVSERVICE_CALLBACK_T callback) {
+    pthread_mutex_lock (&hostLock);
+    for (int i = 0; i < MAX_TV_CALLBACKS; i++) {
+        if (tvCallback[i] == callback) {
+            tvCallback[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock (&hostLock);
+}
+
+// vcsm
+
+int vcsm_init (void) {
+    return 0;
+}
+
+void vcsm_exit (void) {
+}
+
+unsigned int vcsm_malloc_cache (unsigned int size, VCSM_CACHE_TYPE_T cache, char *name) {
+    if (size == 0) {
+        return 0;
+    }
+    hostSharedBlock *block = calloc (1, sizeof (hostSharedBlock));
+    if (block == NULL) {
+        return 0;
+    }
+    block->buffer = calloc (1, size);
+    block->size = size;
+    pthread_mutex_lock (&hostLock);
+    uint32_t handle = block->buffer ? allocHandle (&sharedBlocks, block) : 0;
+    pthread_mutex_unlock (&hostLock);
+    if (handle == 0) {
+        free (block->buffer);
+        free (block);
+    }
+    return handle;
+}
+
+void vcsm_free (unsigned int handle) {
+    pthread_mutex_lock (&hostLock);
+    hostSharedBlock *block = lookupHandle (&sharedBlocks, handle);
+    releaseHandle (&sharedBlocks, handle);
+    pthread_mutex_unlock (&hostLock);
+    if (block != NULL) {
+        free (block->buffer);
+        free (block);
+    }
+}
+
+unsigned int vcsm_vc_hdl_from_hdl (unsigned int handle) {
+    pthread_mutex_lock (&hostLock);
+    hostSharedBlock *block = lookupHandle (&sharedBlocks, handle);
+    pthread_mutex_unlock (&hostLock);
+    return block ? handle : 0;
+}
+
+void *vcsm_lock (unsigned int handle) {
+    pthread_mutex_lock (&hostLock);
+    hostSharedBlock *block = lookupHandle (&sharedBlocks, handle);
+    if (block != NULL) {
+        block->locks++;
+    }
+    pthread_mutex_unlock (&hostLock);
+    return block ? block->buffer : NULL;
+}
+
+int vcsm_unlock_hdl (unsigned int handle) {
+    pthread_mutex_lock (&hostLock);
+    hostSharedBlock *block = lookupHandle (&sharedBlocks, handle);
+    int status = -1;
+    if (block != NULL && block->locks > 0) {
+        block->locks--;
+        status = 0;
+    }
+    pthread_mutex_unlock (&hostLock);
+    return status;
+}
+
+// host memory is coherent, so cache maintenance only checks its arguments
+int vcsm_clean_invalid2 (struct vcsm_user_clean_invalid2_s *s) {
+    if (s == NULL) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < s->op_count; i++) {
+        if (s->s[i].invalidate_mode > VCSM_CACHE_OP_FLUSH || (s->s[i].block_count > 0 && s->s[i].start_address == NULL)) {
+            return -1;
+        }
+    }
+    return 0;
+}
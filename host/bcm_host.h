@@ -0,0 +1,242 @@
+/*  PyDispmanx provides a buffer interface to a Raspberry Pi GPU layer
+*   Copyright (C) 2020,2021  Tim Clark
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Host backend stand-in for the firmware bcm_host.h. Only the subset of the
+// dispmanx and tvservice API used by this module is declared here, with the
+// same names, layouts and values as the userland headers so the module
+// sources build unchanged against either.
+
+#ifndef HOST_BCM_HOST_H
+#define HOST_BCM_HOST_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// image types, values match interface/vctypes/vc_image_types.h
+typedef enum {
+    VC_IMAGE_MIN = 0,
+    VC_IMAGE_RGB565 = 1,
+    VC_IMAGE_RGB888 = 5,
+    VC_IMAGE_8BPP = 6,
+    VC_IMAGE_4BPP = 7,
+    VC_IMAGE_RGBA32 = 15,
+    VC_IMAGE_RGBA16 = 18,
+    VC_IMAGE_MAX
+} VC_IMAGE_TYPE_T;
+
+typedef struct tag_VC_RECT_T {
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+} VC_RECT_T;
+
+typedef uint32_t DISPMANX_DISPLAY_HANDLE_T;
+typedef uint32_t DISPMANX_UPDATE_HANDLE_T;
+typedef uint32_t DISPMANX_ELEMENT_HANDLE_T;
+typedef uint32_t DISPMANX_RESOURCE_HANDLE_T;
+typedef uint32_t DISPMANX_PROTECTION_T;
+typedef int32_t VCHI_MEM_HANDLE_T;
+
+#define DISPMANX_PROTECTION_NONE 0
+#define DISPMANX_NO_HANDLE 0
+
+typedef enum {
+    DISPMANX_NO_ROTATE = 0,
+    DISPMANX_ROTATE_90 = 1,
+    DISPMANX_ROTATE_180 = 2,
+    DISPMANX_ROTATE_270 = 3,
+
+    DISPMANX_FLIP_HRIZ = 1 << 16,
+    DISPMANX_FLIP_VERT = 1 << 17,
+} DISPMANX_TRANSFORM_T;
+
+typedef enum {
+    DISPMANX_FLAGS_ALPHA_FROM_SOURCE = 0,
+    DISPMANX_FLAGS_ALPHA_FIXED_ALL_PIXELS = 1,
+    DISPMANX_FLAGS_ALPHA_FIXED_NON_ZERO = 2,
+    DISPMANX_FLAGS_ALPHA_FIXED_EXCEED_0X07 = 3,
+
+    DISPMANX_FLAGS_ALPHA_PREMULT = 1 << 16,
+    DISPMANX_FLAGS_ALPHA_MIX = 1 << 17,
+} DISPMANX_FLAGS_ALPHA_T;
+
+typedef struct {
+    DISPMANX_FLAGS_ALPHA_T flags;
+    uint32_t opacity;
+    DISPMANX_RESOURCE_HANDLE_T mask;
+} VC_DISPMANX_ALPHA_T;
+
+typedef struct DISPMANX_CLAMP_T_ DISPMANX_CLAMP_T;
+
+typedef enum {
+    DISPLAY_INPUT_FORMAT_INVALID = 0,
+    DISPLAY_INPUT_FORMAT_RGB888,
+    DISPLAY_INPUT_FORMAT_RGB565
+} DISPLAY_INPUT_FORMAT_T;
+
+typedef struct {
+    int32_t width;
+    int32_t height;
+    DISPMANX_TRANSFORM_T transform;
+    DISPLAY_INPUT_FORMAT_T input_format;
+    uint32_t display_num;
+} DISPMANX_MODEINFO_T;
+
+typedef void (*DISPMANX_CALLBACK_FUNC_T)(DISPMANX_UPDATE_HANDLE_T u, void *arg);
+
+// tvservice state flags, values match interface/vmcs_host/vc_hdmi.h and vc_sdtv.h
+typedef enum {
+    VC_HDMI_UNPLUGGED = 1 << 0,
+    VC_HDMI_ATTACHED = 1 << 1,
+    VC_HDMI_DVI = 1 << 2,
+    VC_HDMI_HDMI = 1 << 3,
+    VC_HDMI_HDCP_UNAUTH = 1 << 4,
+    VC_HDMI_HDCP_AUTH = 1 << 5,
+    VC_HDMI_HDCP_KEY_DOWNLOAD = 1 << 6,
+    VC_HDMI_HDCP_SRM_DOWNLOAD = 1 << 7,
+    VC_HDMI_CHANGING_MODE = 1 << 8,
+    VC_SDTV_UNPLUGGED = 1 << 16,
+    VC_SDTV_ATTACHED = 1 << 17,
+    VC_SDTV_NTSC = 1 << 18,
+    VC_SDTV_PAL = 1 << 19,
+    VC_SDTV_CP_INACTIVE = 1 << 20,
+    VC_SDTV_CP_PROTECTED = 1 << 21,
+} VC_HDMI_NOTIFY_T;
+
+typedef enum {
+    HDMI_ASPECT_UNKNOWN = 0,
+    HDMI_ASPECT_4_3 = 1,
+    HDMI_ASPECT_14_9 = 2,
+    HDMI_ASPECT_16_9 = 3,
+    HDMI_ASPECT_5_4 = 4,
+    HDMI_ASPECT_16_10 = 5,
+    HDMI_ASPECT_15_9 = 6,
+    HDMI_ASPECT_64_27 = 7,
+} HDMI_ASPECT_T;
+
+typedef enum {
+    SDTV_ASPECT_UNKNOWN = 0,
+    SDTV_ASPECT_4_3 = 1,
+    SDTV_ASPECT_14_9 = 2,
+    SDTV_ASPECT_16_9 = 3,
+    SDTV_ASPECTFORCE_32BIT = 0x80000000
+} SDTV_ASPECT_T;
+
+typedef struct {
+    SDTV_ASPECT_T aspect;
+} SDTV_OPTIONS_T;
+
+typedef struct {
+    uint32_t state;
+    uint32_t width;
+    uint32_t height;
+    uint16_t frame_rate;
+    uint16_t scan_mode;
+    uint32_t mode;
+    SDTV_OPTIONS_T display_options;
+    uint32_t cp_mode;
+} SDTV_DISPLAY_STATE_T;
+
+typedef struct {
+    uint32_t state;
+    uint32_t width;
+    uint32_t height;
+    uint16_t frame_rate;
+    uint16_t scan_mode;
+    uint32_t group;
+    uint32_t mode;
+    uint16_t pixel_rep;
+    uint16_t aspect_ratio;
+    uint32_t pixel_encoding;
+    uint32_t format_3d;
+} HDMI_DISPLAY_STATE_T;
+
+typedef struct {
+    uint32_t state;
+    union {
+        SDTV_DISPLAY_STATE_T sdtv;
+        HDMI_DISPLAY_STATE_T hdmi;
+    } display;
+} TV_DISPLAY_STATE_T;
+
+#define TV_MAX_ATTACHED_DISPLAYS 16
+
+typedef struct {
+    uint32_t num_attached;
+    uint8_t display_number[TV_MAX_ATTACHED_DISPLAYS];
+} TV_ATTACHED_DEVICES_T;
+
+typedef enum {
+    HDMI_PROPERTY_PIXEL_ENCODING = 0,
+    HDMI_PROPERTY_PIXEL_CLOCK_TYPE = 1,
+} HDMI_PROPERTY_T;
+
+typedef enum {
+    HDMI_PIXEL_CLOCK_TYPE_PAL = 0,
+    HDMI_PIXEL_CLOCK_TYPE_NTSC = 1,
+} HDMI_PIXEL_CLOCK_TYPE_T;
+
+typedef struct {
+    HDMI_PROPERTY_T property;
+    uint32_t param1;
+    uint32_t param2;
+} HDMI_PROPERTY_PARAM_T;
+
+typedef void (*TVSERVICE_CALLBACK_T)(void *callback_data, uint32_t reason, uint32_t param1, uint32_t param2);
+
+// bcm_host
+void bcm_host_init(void);
+void bcm_host_deinit(void);
+
+// dispmanx
+int vc_dispmanx_rect_set(VC_RECT_T *rect, uint32_t x_offset, uint32_t y_offset, uint32_t width, uint32_t height);
+
+DISPMANX_DISPLAY_HANDLE_T vc_dispmanx_display_open(uint32_t device);
+int vc_dispmanx_display_close(DISPMANX_DISPLAY_HANDLE_T display);
+int vc_dispmanx_display_get_info(DISPMANX_DISPLAY_HANDLE_T display, DISPMANX_MODEINFO_T *pinfo);
+
+DISPMANX_RESOURCE_HANDLE_T vc_dispmanx_resource_create(VC_IMAGE_TYPE_T type, uint32_t width, uint32_t height, uint32_t *native_image_handle);
+int vc_dispmanx_resource_write_data(DISPMANX_RESOURCE_HANDLE_T res, VC_IMAGE_TYPE_T src_type, int src_pitch, void *src_address, const VC_RECT_T *rect);
+int vc_dispmanx_resource_write_data_handle(DISPMANX_RESOURCE_HANDLE_T res, VC_IMAGE_TYPE_T src_type, int src_pitch, VCHI_MEM_HANDLE_T handle, uint32_t offset, const VC_RECT_T *rect);
+int vc_dispmanx_resource_set_palette(DISPMANX_RESOURCE_HANDLE_T handle, void *src_address, int offset, int size);
+int vc_dispmanx_resource_delete(DISPMANX_RESOURCE_HANDLE_T res);
+
+DISPMANX_UPDATE_HANDLE_T vc_dispmanx_update_start(int32_t priority);
+DISPMANX_ELEMENT_HANDLE_T vc_dispmanx_element_add(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_DISPLAY_HANDLE_T display, int32_t layer, const VC_RECT_T *dest_rect, DISPMANX_RESOURCE_HANDLE_T src, const VC_RECT_T *src_rect, DISPMANX_PROTECTION_T protection, VC_DISPMANX_ALPHA_T *alpha, DISPMANX_CLAMP_T *clamp, DISPMANX_TRANSFORM_T transform);
+int vc_dispmanx_element_change_source(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_ELEMENT_HANDLE_T element, DISPMANX_RESOURCE_HANDLE_T src);
+int vc_dispmanx_element_change_attributes(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_ELEMENT_HANDLE_T element, uint32_t change_flags, int32_t layer, uint8_t opacity, const VC_RECT_T *dest_rect, const VC_RECT_T *src_rect, DISPMANX_RESOURCE_HANDLE_T mask, DISPMANX_TRANSFORM_T transform);
+int vc_dispmanx_element_remove(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_ELEMENT_HANDLE_T element);
+int vc_dispmanx_update_submit(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_CALLBACK_FUNC_T cb_func, void *cb_arg);
+int vc_dispmanx_update_submit_sync(DISPMANX_UPDATE_HANDLE_T update);
+int vc_dispmanx_vsync_callback(DISPMANX_DISPLAY_HANDLE_T display, DISPMANX_CALLBACK_FUNC_T cb_func, void *cb_arg);
+
+// tvservice
+int vc_tv_get_attached_devices(TV_ATTACHED_DEVICES_T *devices);
+int vc_tv_get_display_state_id(uint32_t display_id, TV_DISPLAY_STATE_T *tvstate);
+int vc_tv_hdmi_get_property_id(uint32_t display_id, HDMI_PROPERTY_PARAM_T *property);
+void vc_tv_register_callback(TVSERVICE_CALLBACK_T callback, void *callback_data);
+void vc_tv_unregister_callback(TVSERVICE_CALLBACK_T callback);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
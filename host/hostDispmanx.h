@@ -0,0 +1,53 @@
+/*  PyDispmanx provides a buffer interface to a Raspberry Pi GPU layer
+*   Copyright (C) 2020,2021  Tim Clark
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Controls for the in-memory host backend that have no firmware equivalent.
+//
+// The virtual display defaults to 1920x1080 at 60Hz, or whatever is given in
+// PYDISPMANX_HOST_MODE as "WIDTHxHEIGHT@RATE". A rate of 0 applies updates as
+// soon as they are submitted instead of at the next simulated vsync.
+//
+// Setting PYDISPMANX_HOST_DUMP to a printf pattern such as "frame%05d.ppm"
+// writes every composited frame to a PPM file.
+
+#ifndef HOST_DISPMANX_H
+#define HOST_DISPMANX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HOST_DISPMANX_DISPLAY_ID 2
+
+// called on the vsync thread with the composited RGBA frame after every update
+typedef void (*HOST_DISPMANX_FRAME_CALLBACK_T)(const uint8_t *rgba, int32_t width, int32_t height, int32_t pitch, uint64_t frame, void *arg);
+
+// change the virtual display mode, only allowed while no display is open,
+// tvservice callbacks are told with VC_HDMI_HDMI as after a real mode change
+bool hostDispmanxSetMode(int32_t width, int32_t height, int32_t frameRate);
+
+// install a hook that receives each composited frame, NULL removes it
+void hostDispmanxSetFrameCallback(HOST_DISPMANX_FRAME_CALLBACK_T callback, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
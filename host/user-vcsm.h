@@ -0,0 +1,70 @@
+/*  PyDispmanx provides a buffer interface to a Raspberry Pi GPU layer
+*   Copyright (C) 2020,2021  Tim Clark
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Host backend stand-in for the firmware user-vcsm.h, the VideoCore shared
+// memory allocator. Only the calls used by this module are declared, with
+// the same names and values as the userland header. The implementation is
+// in bcm_host.c, blocks are heap buffers and the VideoCore handle of a block
+// is the same as its user handle.
+
+#ifndef HOST_USER_VCSM_H
+#define HOST_USER_VCSM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    VCSM_CACHE_TYPE_NONE = 0,
+    VCSM_CACHE_TYPE_HOST,
+    VCSM_CACHE_TYPE_VC,
+    VCSM_CACHE_TYPE_HOST_AND_VC,
+} VCSM_CACHE_TYPE_T;
+
+typedef enum {
+    VCSM_CACHE_OP_NOP = 0x00,
+    VCSM_CACHE_OP_INV = 0x01,
+    VCSM_CACHE_OP_CLEAN = 0x02,
+    VCSM_CACHE_OP_FLUSH = 0x03,
+} VCSM_CACHE_OP_T;
+
+struct vcsm_user_clean_invalid2_s {
+    unsigned char op_count;
+    unsigned char zero[3];
+    struct vcsm_user_clean_invalid2_block_s {
+        unsigned short invalidate_mode;
+        unsigned short block_count;
+        void *start_address;
+        unsigned int block_size;
+        unsigned int inter_block_stride;
+    } s[0];
+};
+
+int vcsm_init(void);
+void vcsm_exit(void);
+unsigned int vcsm_malloc_cache(unsigned int size, VCSM_CACHE_TYPE_T cache, char *name);
+void vcsm_free(unsigned int handle);
+unsigned int vcsm_vc_hdl_from_hdl(unsigned int handle);
+void *vcsm_lock(unsigned int handle);
+int vcsm_unlock_hdl(unsigned int handle);
+int vcsm_clean_invalid2(struct vcsm_user_clean_invalid2_s *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -50,8 +50,49 @@ void getPixelRGBA16(IMAGE_T *image, int32_t x, int32_t y, RGBA8_T *rgba);
 void getPixelRGBA32(IMAGE_T *image, int32_t x, int32_t y, RGBA8_T *rgba);
 
 //-------------------------------------------------------------------------
+// ordered dither matrices, indexed by (x & 7) | ((y & 7) << 3)
 
-bool initImage(
+static const int16_t dither8[64] =
+{
+    1, 6, 2, 7, 1, 6, 2, 7,
+    4, 2, 5, 4, 4, 3, 6, 4,
+    1, 7, 1, 6, 2, 7, 1, 7,
+    5, 3, 5, 3, 5, 4, 5, 3,
+    1, 6, 2, 7, 1, 6, 2, 7,
+    4, 3, 6, 4, 4, 2, 6, 4,
+    2, 7, 1, 7, 2, 7, 1, 6,
+    5, 3, 5, 3, 5, 3, 5, 3,
+};
+
+static const int16_t dither4[64] =
+{
+    1, 3, 1, 3, 1, 3, 1, 3,
+    2, 1, 3, 2, 2, 1, 3, 2,
+    1, 3, 1, 3, 1, 3, 1, 3,
+    2, 2, 2, 1, 3, 2, 2, 2,
+    1, 3, 1, 3, 1, 3, 1, 3,
+    2, 1, 3, 2, 2, 1, 3, 2,
+    1, 3, 1, 3, 1, 3, 1, 3,
+    3, 2, 2, 2, 2, 2, 2, 2,
+};
+
+static const int16_t dither16[64] =
+{
+     1,  12,   4,  15,   1,  13,   4,  15,
+     8,   4,  11,   7,   9,   5,  12,   8,
+     3,  14,   2,  13,   3,  15,   2,  14,
+    10,   6,   9,   5,  11,   7,  10,   6,
+     1,  12,   4,  15,   1,  12,   4,  15,
+     9,   5,  12,   8,   8,   5,  11,   8,
+     3,  14,   2,  13,   3,  14,   2,  13,
+    11,   7,  10,   6,  10,   7,   9,   6,
+};
+
+//-------------------------------------------------------------------------
+// Set up the type, geometry and pixel functions of an image without
+// allocating its buffer, so a pooled buffer of the same size can be used.
+
+bool initImageGeometry(
     IMAGE_T *image,
     VC_IMAGE_TYPE_T type,
     int32_t width,
@@ -146,40 +187,195 @@ bool initImage(
     image->type = type;
     image->width = width;
     image->height = height;
-    image->pitch = (width * image->bitsPerPixel) / 8;
-    image->alignedHeight = height;
+    image->pitch = ALIGN_UP(((width * image->bitsPerPixel) + 7) / 8,
+                            IMAGE_PITCH_ALIGN);
+    image->alignedHeight = ALIGN_UP(height, IMAGE_HEIGHT_ALIGN);
     image->size = image->pitch * image->alignedHeight;
+    image->buffer = NULL;
+
+    return true;
+}
 
-    image->buffer = calloc(1, image->size);
+//-------------------------------------------------------------------------
 
-    if (image->buffer == NULL)
+bool initImage(
+    IMAGE_T *image,
+    VC_IMAGE_TYPE_T type,
+    int32_t width,
+    int32_t height,
+    bool dither)
+{
+    if (initImageGeometry(image, type, width, height, dither) == false)
     {
-        fprintf(stderr, "image: memory exhausted\n");
-        exit(EXIT_FAILURE);
+        return false;
+    }
+
+    if (posix_memalign(&(image->buffer),
+                       IMAGE_BUFFER_ALIGN,
+                       image->size) != 0)
+    {
+        image->buffer = NULL;
+        return false;
     }
 
+    memset(image->buffer, 0, image->size);
+
     return true;
 }
 
 //-------------------------------------------------------------------------
 
-void
-clearImageIndexed(
+static void
+setPixelPattern(
     IMAGE_T *image,
+    int32_t x,
+    int32_t y,
+    const RGBA8_T *rgb,
     int8_t index)
 {
-    if (image->setPixelIndexed != NULL)
+    if (image->setPixelDirect != NULL)
+    {
+        image->setPixelDirect(image, x, y, rgb);
+    }
+    else
+    {
+        image->setPixelIndexed(image, x, y, index);
+    }
+}
+
+//-------------------------------------------------------------------------
+// Fill a region with one colour. Only an 8x8 tile, the period of the
+// dither matrices, goes through the per pixel functions. Each row of the
+// tile is then doubled across the region and the rows are doubled down it
+// with memcpy, which keeps the dither phase and runs at copy bandwidth.
+
+static void
+fillPattern(
+    IMAGE_T *image,
+    int32_t x,
+    int32_t y,
+    int32_t width,
+    int32_t height,
+    const RGBA8_T *rgb,
+    int8_t index)
+{
+    int32_t i;
+    int32_t j;
+
+    if ((width <= 0) || (height <= 0))
+    {
+        return;
+    }
+
+    if (image->bitsPerPixel == 4)
     {
-        int j;
-        for (j = 0 ; j < image->height ; j++)
+        // columns sharing a byte with pixels outside the region are set
+        // one pixel at a time so the rest of the fill is whole bytes
+
+        if (x % 2)
         {
-            int i;
-            for (i = 0 ; i < image->width ; i++)
+            for (j = y ; j < y + height ; j++)
             {
-                image->setPixelIndexed(image, i, j, index);
+                setPixelPattern(image, x, j, rgb, index);
             }
+
+            x++;
+            width--;
+        }
+
+        if (width % 2)
+        {
+            for (j = y ; j < y + height ; j++)
+            {
+                setPixelPattern(image, x + width - 1, j, rgb, index);
+            }
+
+            width--;
+        }
+
+        if (width <= 0)
+        {
+            return;
         }
     }
+
+    int32_t seedWidth = (width < 8) ? width : 8;
+    int32_t seedHeight = (height < 8) ? height : 8;
+    size_t seedBytes = (seedWidth * image->bitsPerPixel) / 8;
+    size_t rowBytes = (width * image->bitsPerPixel) / 8;
+    uint8_t *base = (uint8_t *)(image->buffer)
+                  + (y * image->pitch)
+                  + ((x * image->bitsPerPixel) / 8);
+
+    for (j = 0 ; j < seedHeight ; j++)
+    {
+        for (i = 0 ; i < seedWidth ; i++)
+        {
+            setPixelPattern(image, x + i, y + j, rgb, index);
+        }
+
+        uint8_t *row = base + (j * image->pitch);
+        size_t filled = seedBytes;
+
+        while (filled < rowBytes)
+        {
+            size_t bytes = rowBytes - filled;
+
+            if (bytes > filled)
+            {
+                bytes = filled;
+            }
+
+            memcpy(row + filled, row, bytes);
+            filled += bytes;
+        }
+    }
+
+    //---------------------------------------------------------------------
+
+    bool wholeRows = (x == 0) && (width == image->width);
+    int32_t filledRows = seedHeight;
+
+    while (filledRows < height)
+    {
+        int32_t rows = height - filledRows;
+
+        if (rows > filledRows)
+        {
+            rows = filledRows;
+        }
+
+        if (wholeRows)
+        {
+            memcpy(base + (filledRows * image->pitch),
+                   base,
+                   rows * image->pitch);
+        }
+        else
+        {
+            for (j = 0 ; j < rows ; j++)
+            {
+                memcpy(base + ((filledRows + j) * image->pitch),
+                       base + (j * image->pitch),
+                       rowBytes);
+            }
+        }
+
+        filledRows += rows;
+    }
+}
+
+//-------------------------------------------------------------------------
+
+void
+clearImageIndexed(
+    IMAGE_T *image,
+    int8_t index)
+{
+    if (image->setPixelIndexed != NULL)
+    {
+        fillPattern(image, 0, 0, image->width, image->height, NULL, index);
+    }
 }
 
 //-------------------------------------------------------------------------
@@ -191,16 +387,493 @@ clearImageRGB(
 {
     if (image->setPixelDirect != NULL)
     {
-        int j;
-        for (j = 0 ; j < image->height ; j++)
+        fillPattern(image, 0, 0, image->width, image->height, rgb, 0);
+    }
+}
+
+//-------------------------------------------------------------------------
+
+static bool
+clipRect(
+    const IMAGE_T *image,
+    int32_t *x,
+    int32_t *y,
+    int32_t *width,
+    int32_t *height)
+{
+    if (*x < 0)
+    {
+        *width += *x;
+        *x = 0;
+    }
+
+    if (*y < 0)
+    {
+        *height += *y;
+        *y = 0;
+    }
+
+    if (*x + *width > image->width)
+    {
+        *width = image->width - *x;
+    }
+
+    if (*y + *height > image->height)
+    {
+        *height = image->height - *y;
+    }
+
+    return (*width > 0) && (*height > 0);
+}
+
+//-------------------------------------------------------------------------
+
+bool
+fillRectIndexed(
+    IMAGE_T *image,
+    int32_t x,
+    int32_t y,
+    int32_t width,
+    int32_t height,
+    int8_t index)
+{
+    if ((image->setPixelIndexed == NULL) ||
+        (clipRect(image, &x, &y, &width, &height) == false))
+    {
+        return false;
+    }
+
+    fillPattern(image, x, y, width, height, NULL, index);
+
+    return true;
+}
+
+//-------------------------------------------------------------------------
+
+bool
+fillRectRGB(
+    IMAGE_T *image,
+    int32_t x,
+    int32_t y,
+    int32_t width,
+    int32_t height,
+    const RGBA8_T *rgb)
+{
+    if ((image->setPixelDirect == NULL) ||
+        (clipRect(image, &x, &y, &width, &height) == false))
+    {
+        return false;
+    }
+
+    fillPattern(image, x, y, width, height, rgb, 0);
+
+    return true;
+}
+
+//-------------------------------------------------------------------------
+
+bool
+hlineIndexed(
+    IMAGE_T *image,
+    int32_t x,
+    int32_t y,
+    int32_t length,
+    int8_t index)
+{
+    return fillRectIndexed(image, x, y, length, 1, index);
+}
+
+//-------------------------------------------------------------------------
+
+bool
+hlineRGB(
+    IMAGE_T *image,
+    int32_t x,
+    int32_t y,
+    int32_t length,
+    const RGBA8_T *rgb)
+{
+    return fillRectRGB(image, x, y, length, 1, rgb);
+}
+
+//-------------------------------------------------------------------------
+
+bool
+vlineIndexed(
+    IMAGE_T *image,
+    int32_t x,
+    int32_t y,
+    int32_t length,
+    int8_t index)
+{
+    return fillRectIndexed(image, x, y, 1, length, index);
+}
+
+//-------------------------------------------------------------------------
+
+bool
+vlineRGB(
+    IMAGE_T *image,
+    int32_t x,
+    int32_t y,
+    int32_t length,
+    const RGBA8_T *rgb)
+{
+    return fillRectRGB(image, x, y, 1, length, rgb);
+}
+
+//-------------------------------------------------------------------------
+
+static void
+blendRowRGBA32(
+    uint8_t *dst,
+    const uint8_t *src,
+    int32_t width)
+{
+    int32_t i;
+    for (i = 0 ; i < width ; i++, dst += 4, src += 4)
+    {
+        uint32_t alpha = src[3];
+
+        if (alpha == 255)
         {
-            int i;
-            for (i = 0 ; i < image->width ; i++)
-            {
-                image->setPixelDirect(image, i, j, rgb);
-            }
+            memcpy(dst, src, 4);
+        }
+        else if (alpha != 0)
+        {
+            uint32_t inverse = 255 - alpha;
+
+            dst[0] = (src[0] * alpha + dst[0] * inverse + 127) / 255;
+            dst[1] = (src[1] * alpha + dst[1] * inverse + 127) / 255;
+            dst[2] = (src[2] * alpha + dst[2] * inverse + 127) / 255;
+            dst[3] = alpha + (dst[3] * inverse + 127) / 255;
+        }
+    }
+}
+
+//-------------------------------------------------------------------------
+
+static void
+blendRowGeneric(
+    IMAGE_T *dst,
+    int32_t x,
+    int32_t y,
+    IMAGE_T *src,
+    int32_t srcX,
+    int32_t srcY,
+    int32_t width)
+{
+    int32_t i;
+    for (i = 0 ; i < width ; i++)
+    {
+        RGBA8_T s;
+        RGBA8_T d;
+
+        src->getPixelDirect(src, srcX + i, srcY, &s);
+
+        if (s.alpha == 255)
+        {
+            dst->setPixelDirect(dst, x + i, y, &s);
+        }
+        else if (s.alpha != 0)
+        {
+            uint32_t inverse = 255 - s.alpha;
+
+            dst->getPixelDirect(dst, x + i, y, &d);
+
+            d.red = (s.red * s.alpha + d.red * inverse + 127) / 255;
+            d.green = (s.green * s.alpha + d.green * inverse + 127) / 255;
+            d.blue = (s.blue * s.alpha + d.blue * inverse + 127) / 255;
+            d.alpha = s.alpha + (d.alpha * inverse + 127) / 255;
+
+            dst->setPixelDirect(dst, x + i, y, &d);
+        }
+    }
+}
+
+//-------------------------------------------------------------------------
+
+static void
+copyRowIndexed(
+    IMAGE_T *dst,
+    int32_t x,
+    int32_t y,
+    IMAGE_T *src,
+    int32_t srcX,
+    int32_t srcY,
+    int32_t width)
+{
+    // copy right to left when moving pixels right within the same buffer
+    bool reverse = (src->buffer == dst->buffer) && (x > srcX);
+
+    int32_t i;
+    for (i = 0 ; i < width ; i++)
+    {
+        int32_t column = reverse ? width - 1 - i : i;
+        int8_t index;
+
+        src->getPixelIndexed(src, srcX + column, srcY, &index);
+        dst->setPixelIndexed(dst, x + column, y, index);
+    }
+}
+
+//-------------------------------------------------------------------------
+
+bool
+blitImage(
+    IMAGE_T *dst,
+    int32_t x,
+    int32_t y,
+    IMAGE_T *src,
+    int32_t srcX,
+    int32_t srcY,
+    int32_t width,
+    int32_t height,
+    bool blend)
+{
+    if (src->type != dst->type)
+    {
+        return false;
+    }
+
+    //---------------------------------------------------------------------
+    // clip to the source and then the destination, moving the other side
+    // of the copy to match
+
+    int32_t left = srcX;
+    int32_t top = srcY;
+
+    if (clipRect(src, &srcX, &srcY, &width, &height) == false)
+    {
+        return false;
+    }
+
+    x += srcX - left;
+    y += srcY - top;
+    left = x;
+    top = y;
+
+    if (clipRect(dst, &x, &y, &width, &height) == false)
+    {
+        return false;
+    }
+
+    srcX += x - left;
+    srcY += y - top;
+
+    //---------------------------------------------------------------------
+
+    bool hasAlpha = (dst->type == VC_IMAGE_RGBA32)
+                 || (dst->type == VC_IMAGE_RGBA16);
+    bool byteAligned = (dst->bitsPerPixel != 4)
+                    || (((x | srcX | width) % 2) == 0);
+
+    // copy bottom up when moving rows down within the same buffer
+    bool reverse = (src->buffer == dst->buffer) && (y > srcY);
+    int32_t bytes = (width * dst->bitsPerPixel) / 8;
+
+    int32_t j;
+    for (j = 0 ; j < height ; j++)
+    {
+        int32_t row = reverse ? height - 1 - j : j;
+        uint8_t *to = (uint8_t *)(dst->buffer)
+                    + ((y + row) * dst->pitch)
+                    + ((x * dst->bitsPerPixel) / 8);
+        uint8_t *from = (uint8_t *)(src->buffer)
+                      + ((srcY + row) * src->pitch)
+                      + ((srcX * src->bitsPerPixel) / 8);
+
+        if (blend && hasAlpha && (dst->type == VC_IMAGE_RGBA32))
+        {
+            blendRowRGBA32(to, from, width);
+        }
+        else if (blend && hasAlpha)
+        {
+            blendRowGeneric(dst, x, y + row, src, srcX, srcY + row, width);
+        }
+        else if (byteAligned)
+        {
+            memmove(to, from, bytes);
+        }
+        else
+        {
+            copyRowIndexed(dst, x, y + row, src, srcX, srcY + row, width);
         }
     }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------
+
+static const int16_t noDither[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+// RGBA32 pixels are read as one little endian word, red in the low byte
+
+static inline uint16_t
+convertPixelRGB565(
+    uint32_t rgba,
+    int16_t ditherRB,
+    int16_t ditherG)
+{
+    int32_t r = (rgba & 0xFF) + ditherRB;
+    int32_t g = ((rgba >> 8) & 0xFF) + ditherG;
+    int32_t b = ((rgba >> 16) & 0xFF) + ditherRB;
+
+    r = (r > 255) ? 255 : r;
+    g = (g > 255) ? 255 : g;
+    b = (b > 255) ? 255 : b;
+
+    return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+}
+
+//-------------------------------------------------------------------------
+// The dither matrices repeat every 8 pixels, so the row is converted in
+// groups of 8 with a fixed table row, which the compiler can vectorise.
+
+static void
+convertRowRGB565(
+    uint16_t *restrict out,
+    const uint32_t *restrict in,
+    int32_t width,
+    const int16_t *ditherRB,
+    const int16_t *ditherG)
+{
+    int32_t i = 0;
+    int32_t k = 0;
+
+    for (i = 0 ; i + 8 <= width ; i += 8)
+    {
+        for (k = 0 ; k < 8 ; k++)
+        {
+            out[i + k] = convertPixelRGB565(in[i + k],
+                                            ditherRB[k],
+                                            ditherG[k]);
+        }
+    }
+
+    for (k = 0 ; i < width ; i++, k++)
+    {
+        out[i] = convertPixelRGB565(in[i], ditherRB[k], ditherG[k]);
+    }
+}
+
+//-------------------------------------------------------------------------
+
+static inline uint16_t
+convertPixelRGBA16(
+    uint32_t rgba,
+    int16_t dither)
+{
+    int32_t r = (rgba & 0xFF) + dither;
+    int32_t g = ((rgba >> 8) & 0xFF) + dither;
+    int32_t b = ((rgba >> 16) & 0xFF) + dither;
+    int32_t a = (rgba >> 24) + dither;
+
+    r = (r > 255) ? 255 : r;
+    g = (g > 255) ? 255 : g;
+    b = (b > 255) ? 255 : b;
+    a = (a > 255) ? 255 : a;
+
+    return ((r >> 4) << 12) | ((g >> 4) << 8) | ((b >> 4) << 4) | (a >> 4);
+}
+
+//-------------------------------------------------------------------------
+
+static void
+convertRowRGBA16(
+    uint16_t *restrict out,
+    const uint32_t *restrict in,
+    int32_t width,
+    const int16_t *dither)
+{
+    int32_t i = 0;
+    int32_t k = 0;
+
+    for (i = 0 ; i + 8 <= width ; i += 8)
+    {
+        for (k = 0 ; k < 8 ; k++)
+        {
+            out[i + k] = convertPixelRGBA16(in[i + k], dither[k]);
+        }
+    }
+
+    for (k = 0 ; i < width ; i++, k++)
+    {
+        out[i] = convertPixelRGBA16(in[i], dither[k]);
+    }
+}
+
+//-------------------------------------------------------------------------
+// Convert whole rows of an RGBA32 image into an RGB565 or RGBA16 image of
+// the same size. The destination is dithered with the same matrices as the
+// per pixel functions if it was initialised with dithering.
+
+bool
+convertImageRows(
+    IMAGE_T *dst,
+    const IMAGE_T *src,
+    int32_t top,
+    int32_t rows)
+{
+    if ((src->type != VC_IMAGE_RGBA32) ||
+        (dst->width != src->width) ||
+        (dst->height != src->height))
+    {
+        return false;
+    }
+
+    if (top < 0)
+    {
+        rows += top;
+        top = 0;
+    }
+
+    if (top + rows > dst->height)
+    {
+        rows = dst->height - top;
+    }
+
+    bool dither = (dst->setPixelDirect == setPixelDitheredRGB565)
+               || (dst->setPixelDirect == setPixelDitheredRGBA16);
+
+    int32_t j;
+    for (j = top ; j < top + rows ; j++)
+    {
+        const uint32_t *in = (const uint32_t *)((uint8_t *)(src->buffer) + (j * src->pitch));
+        uint16_t *out = (uint16_t *)((uint8_t *)(dst->buffer) + (j * dst->pitch));
+        int32_t row = (j & 7) << 3;
+
+        switch (dst->type)
+        {
+        case VC_IMAGE_RGB565:
+
+            convertRowRGB565(out,
+                             in,
+                             dst->width,
+                             dither ? &(dither8[row]) : noDither,
+                             dither ? &(dither4[row]) : noDither);
+
+            break;
+
+        case VC_IMAGE_RGBA16:
+
+            convertRowRGBA16(out,
+                             in,
+                             dst->width,
+                             dither ? &(dither16[row]) : noDither);
+
+            break;
+
+        default:
+
+            return false;
+
+            break;
+        }
+    }
+
+    return true;
 }
 
 //-------------------------------------------------------------------------
@@ -377,30 +1050,6 @@ setPixelDitheredRGB565(
     int32_t y,
     const RGBA8_T *rgba)
 {
-    static int16_t dither8[64] =
-    {
-        1, 6, 2, 7, 1, 6, 2, 7,
-        4, 2, 5, 4, 4, 3, 6, 4,
-        1, 7, 1, 6, 2, 7, 1, 7,
-        5, 3, 5, 3, 5, 4, 5, 3,
-        1, 6, 2, 7, 1, 6, 2, 7,
-        4, 3, 6, 4, 4, 2, 6, 4,
-        2, 7, 1, 7, 2, 7, 1, 6,
-        5, 3, 5, 3, 5, 3, 5, 3,
-    };
-
-    static int16_t dither4[64] =
-    {
-        1, 3, 1, 3, 1, 3, 1, 3,
-        2, 1, 3, 2, 2, 1, 3, 2,
-        1, 3, 1, 3, 1, 3, 1, 3,
-        2, 2, 2, 1, 3, 2, 2, 2,
-        1, 3, 1, 3, 1, 3, 1, 3,
-        2, 1, 3, 2, 2, 1, 3, 2,
-        1, 3, 1, 3, 1, 3, 1, 3,
-        3, 2, 2, 2, 2, 2, 2, 2,
-    };
-
     int32_t index = (x & 7) | ((y & 7) << 3);
 
     int16_t r = rgba->red + dither8[index];
@@ -471,18 +1120,6 @@ setPixelDitheredRGBA16(
     int32_t y,
     const RGBA8_T *rgba)
 {
-    static int16_t dither16[64] =
-    {
-         1,  12,   4,  15,   1,  13,   4,  15,
-         8,   4,  11,   7,   9,   5,  12,   8,
-         3,  14,   2,  13,   3,  15,   2,  14,
-        10,   6,   9,   5,  11,   7,  10,   6,
-         1,  12,   4,  15,   1,  12,   4,  15,
-         9,   5,  12,   8,   8,   5,  11,   8,
-         3,  14,   2,  13,   3,  14,   2,  13,
-        11,   7,  10,   6,  10,   7,   9,   6,
-    };
-
     int32_t index = (x & 7) | ((y & 7) << 3);
 
     int16_t r = rgba->red + dither16[index];
@@ -508,9 +1145,9 @@ setPixelDitheredRGBA16(
 
     int16_t a = rgba->alpha + dither16[index];
 
-    if (b > 255)
+    if (a > 255)
     {
-        b = 255;
+        a = 255;
     }
 
     RGBA8_T dithered = { r, g, b, a };
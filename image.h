@@ -38,6 +38,18 @@
     
 //-------------------------------------------------------------------------
 
+// VideoCore transfers take the fast path when rows are a multiple of 32
+// bytes and the height a multiple of 16 rows. Buffers are page aligned so
+// rows never straddle more cache lines than they need to.
+
+#define IMAGE_PITCH_ALIGN 32
+#define IMAGE_HEIGHT_ALIGN 16
+#define IMAGE_BUFFER_ALIGN 4096
+
+#define ALIGN_UP(x, a) (((x) + ((a) - 1)) & ~((a) - 1))
+
+//-------------------------------------------------------------------------
+
 typedef struct
 {
     uint8_t red;
@@ -96,6 +108,14 @@ typedef enum
 
 //-------------------------------------------------------------------------
 
+bool
+initImageGeometry(
+    IMAGE_T *image,
+    VC_IMAGE_TYPE_T type,
+    int32_t width,
+    int32_t height,
+    bool dither);
+
 bool
 initImage(
     IMAGE_T *image,
@@ -114,6 +134,75 @@ clearImageRGB(
     IMAGE_T *image,
     const RGBA8_T *rgb);
 
+bool
+fillRectIndexed(
+    IMAGE_T *image,
+    int32_t x,
+    int32_t y,
+    int32_t width,
+    int32_t height,
+    int8_t index);
+
+bool
+fillRectRGB(
+    IMAGE_T *image,
+    int32_t x,
+    int32_t y,
+    int32_t width,
+    int32_t height,
+    const RGBA8_T *rgb);
+
+bool
+hlineIndexed(
+    IMAGE_T *image,
+    int32_t x,
+    int32_t y,
+    int32_t length,
+    int8_t index);
+
+bool
+hlineRGB(
+    IMAGE_T *image,
+    int32_t x,
+    int32_t y,
+    int32_t length,
+    const RGBA8_T *rgb);
+
+bool
+vlineIndexed(
+    IMAGE_T *image,
+    int32_t x,
+    int32_t y,
+    int32_t length,
+    int8_t index);
+
+bool
+vlineRGB(
+    IMAGE_T *image,
+    int32_t x,
+    int32_t y,
+    int32_t length,
+    const RGBA8_T *rgb);
+
+bool
+blitImage(
+    IMAGE_T *dst,
+    int32_t x,
+    int32_t y,
+    IMAGE_T *src,
+    int32_t srcX,
+    int32_t srcY,
+    int32_t width,
+    int32_t height,
+    bool blend);
+
+bool
+convertImageRows(
+    IMAGE_T *dst,
+    const IMAGE_T *src,
+    int32_t top,
+    int32_t rows);
+
 bool
 setPixelIndexed(
     IMAGE_T *image,
@@ -26,11 +26,103 @@
 //-------------------------------------------------------------------------
 
 #include <assert.h>
+#include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "element_change.h"
 #include "image.h"
 #include "imageLayer.h"
+#include "pool.h"
+
+//-------------------------------------------------------------------------
+
+static uint64_t
+nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+//-------------------------------------------------------------------------
+// Write rows of the upload image to a resource, counting the bytes and
+// the time taken.
+
+static void
+writeDataImageLayer(
+    IMAGE_LAYER_T *il,
+    DISPMANX_RESOURCE_HANDLE_T resource,
+    IMAGE_T *upload,
+    const VC_RECT_T *rect)
+{
+    uint64_t start = nowNs();
+
+    int result = 0;
+
+    if ((il->sharedHandle != 0) && (upload == &(il->image)))
+    {
+        // clean the rows out of the ARM cache and let the GPU copy them
+
+        union
+        {
+            struct vcsm_user_clean_invalid2_s op;
+            uint8_t bytes[sizeof(struct vcsm_user_clean_invalid2_s) +
+                          sizeof(struct vcsm_user_clean_invalid2_block_s)];
+        } clean;
+
+        memset(&clean, 0, sizeof(clean));
+        clean.op.op_count = 1;
+        clean.op.s[0].invalidate_mode = VCSM_CACHE_OP_CLEAN;
+        clean.op.s[0].block_count = 1;
+        clean.op.s[0].start_address = (uint8_t *)(upload->buffer)
+                                    + (rect->y * upload->pitch);
+        clean.op.s[0].block_size = rect->height * upload->pitch;
+        clean.op.s[0].inter_block_stride = 0;
+
+        result = vcsm_clean_invalid2(&(clean.op));
+        assert(result == 0);
+
+        result = vc_dispmanx_resource_write_data_handle(resource,
+                                                        upload->type,
+                                                        upload->pitch,
+                                                        il->sharedVcHandle,
+                                                        0,
+                                                        rect);
+    }
+    else
+    {
+        result = vc_dispmanx_resource_write_data(resource,
+                                                 upload->type,
+                                                 upload->pitch,
+                                                 upload->buffer,
+                                                 rect);
+    }
+    assert(result == 0);
+
+    uint64_t elapsed = nowNs() - start;
+
+    // the upload thread of a pipelined layer counts while the stats may be
+    // read or reset, so the counters are only touched under pendingLock
+
+    pthread_mutex_lock(&(il->pendingLock));
+
+    il->stats.bytesUploaded += (uint64_t)(upload->pitch) * rect->height;
+    il->stats.writes++;
+    il->stats.writeNs += elapsed;
+
+    if (elapsed > il->stats.maxWriteNs)
+    {
+        il->stats.maxWriteNs = elapsed;
+    }
+
+    pthread_mutex_unlock(&(il->pendingLock));
+}
 
 //-------------------------------------------------------------------------
 
@@ -41,7 +133,128 @@ initImageLayer(
     int32_t height,
     VC_IMAGE_TYPE_T type)
 {
-    initImage(&(il->image), type, width, height, false);
+    if (initImage(&(il->image), type, width, height, false) == false)
+    {
+        fprintf(stderr, "imageLayer: unable to create image\n");
+        exit(EXIT_FAILURE);
+    }
+
+    il->convert = false;
+    il->blockHash = NULL;
+}
+
+//-------------------------------------------------------------------------
+// Move the image into VideoCore shared memory. Updates are then copied into
+// the resources by the GPU straight from the buffer that was drawn into,
+// instead of by the ARM through a bulk transfer. Must be called before the
+// buffer is handed out and can't be combined with convertImageLayer.
+
+static pthread_once_t vcsmOnce = PTHREAD_ONCE_INIT;
+static bool vcsmReady = false;
+static char vcsmName[] = "pydispmanx";
+
+static void
+initVcsm(void)
+{
+    vcsmReady = (vcsm_init() == 0);
+}
+
+bool
+shareImageLayer(
+    IMAGE_LAYER_T *il)
+{
+    pthread_once(&vcsmOnce, initVcsm);
+
+    if ((vcsmReady == false) || il->convert)
+    {
+        return false;
+    }
+
+    unsigned int handle = vcsm_malloc_cache(il->image.size,
+                                            VCSM_CACHE_TYPE_HOST,
+                                            vcsmName);
+    if (handle == 0)
+    {
+        return false;
+    }
+
+    // stays locked for the life of the layer so the address never moves
+
+    void *buffer = vcsm_lock(handle);
+    VCHI_MEM_HANDLE_T vcHandle = vcsm_vc_hdl_from_hdl(handle);
+
+    if ((buffer == NULL) || (vcHandle == 0))
+    {
+        if (buffer != NULL)
+        {
+            vcsm_unlock_hdl(handle);
+        }
+        vcsm_free(handle);
+        return false;
+    }
+
+    memcpy(buffer, il->image.buffer, il->image.size);
+
+    // the old buffer may have come from the pool, so it goes back there
+
+    IMAGE_T old = il->image;
+    destroyImagePool(&old);
+
+    il->image.buffer = buffer;
+    il->sharedHandle = handle;
+    il->sharedVcHandle = vcHandle;
+
+    return true;
+}
+
+//-------------------------------------------------------------------------
+// Upload an RGBA32 image as RGB565 or RGBA16. The resources are created in
+// the upload format and only the dirty rows are converted, with dithering,
+// before each write. Must be called before the resources are created.
+
+bool
+convertImageLayer(
+    IMAGE_LAYER_T *il,
+    VC_IMAGE_TYPE_T type)
+{
+    if ((il->image.type != VC_IMAGE_RGBA32) ||
+        (il->sharedHandle != 0) ||
+        ((type != VC_IMAGE_RGB565) && (type != VC_IMAGE_RGBA16)))
+    {
+        return false;
+    }
+
+    if (initImagePool(&(il->upload),
+                  type,
+                  il->image.width,
+                  il->image.height,
+                  true) == false)
+    {
+        return false;
+    }
+
+    il->convert = true;
+
+    return true;
+}
+
+//-------------------------------------------------------------------------
+
+static IMAGE_T *
+uploadImageLayer(
+    IMAGE_LAYER_T *il,
+    IMAGE_T *source,
+    int32_t top,
+    int32_t rows)
+{
+    if (il->convert == false)
+    {
+        return source;
+    }
+
+    convertImageRows(&(il->upload), source, top, rows);
+
+    return &(il->upload);
 }
 
 //-------------------------------------------------------------------------
@@ -51,20 +264,35 @@ createResourceImageLayer(
     IMAGE_LAYER_T *il,
     int32_t layer)
 {
-    uint32_t vc_image_ptr;
-    int result = 0;
+    createResourcesImageLayer(il, layer, 1);
+}
+
+//-------------------------------------------------------------------------
+
+void
+createResourcesImageLayer(
+    IMAGE_LAYER_T *il,
+    int32_t layer,
+    int32_t numResources)
+{
+    assert((numResources > 0) && (numResources <= IMAGE_LAYER_MAX_RESOURCES));
 
     il->layer = layer;
+    il->opacity = 255;
+    il->transform = DISPMANX_NO_ROTATE;
+    il->dirtyBands = 0;
+    il->numResources = numResources;
+    il->backResource = 1 % numResources;
+    il->pendingUpdates = 0;
+    il->updatesSubmitted = 0;
+    il->updatesDone = 0;
+    il->pipeline = NULL;
+    il->notify = NULL;
 
-    il->resource =
-        vc_dispmanx_resource_create(
-            il->image.type,
-            il->image.width | (il->image.pitch << 16),
-            il->image.height | (il->image.alignedHeight << 16),
-            &vc_image_ptr);
-    assert(il->resource != 0);
+    memset(&(il->stats), 0, sizeof(il->stats));
 
-    //---------------------------------------------------------------------
+    pthread_mutex_init(&(il->pendingLock), NULL);
+    pthread_cond_init(&(il->pendingDone), NULL);
 
     vc_dispmanx_rect_set(&(il->bmpRect),
                          0,
@@ -72,12 +300,87 @@ createResourceImageLayer(
                          il->image.width,
                          il->image.height);
 
-    result = vc_dispmanx_resource_write_data(il->resource,
-                                             il->image.type,
-                                             il->image.pitch,
-                                             il->image.buffer,
-                                             &(il->bmpRect));
-    assert(result == 0);
+    IMAGE_T *upload = uploadImageLayer(il, &(il->image), 0, il->image.height);
+
+    //---------------------------------------------------------------------
+
+    int32_t i;
+    for (i = 0 ; i < numResources ; i++)
+    {
+        il->resources[i] = takeResourcePool(upload);
+
+        writeDataImageLayer(il, il->resources[i], upload, &(il->bmpRect));
+
+        il->staleBands[i] = 0;
+    }
+
+    il->resource = il->resources[0];
+
+    //---------------------------------------------------------------------
+    // indexed layers start with a grey ramp, which also replaces whatever
+    // palette a pooled resource was left with
+
+    il->paletteSize = 0;
+
+    if (upload->type == VC_IMAGE_8BPP)
+    {
+        il->paletteSize = 256;
+    }
+    else if (upload->type == VC_IMAGE_4BPP)
+    {
+        il->paletteSize = 16;
+    }
+
+    if (il->paletteSize > 0)
+    {
+        uint16_t ramp[IMAGE_LAYER_MAX_PALETTE];
+
+        for (i = 0 ; i < il->paletteSize ; i++)
+        {
+            uint16_t grey = (i * 255) / (il->paletteSize - 1);
+            ramp[i] = ((grey >> 3) << 11) | ((grey >> 2) << 5) | (grey >> 3);
+        }
+
+        setPaletteImageLayer(il, ramp, 0, il->paletteSize);
+    }
+}
+
+//-------------------------------------------------------------------------
+// Replace count RGB565 palette entries from first on. Every resource gets
+// the new entries straight away, so they show from the next frame without
+// an update.
+
+bool
+setPaletteImageLayer(
+    IMAGE_LAYER_T *il,
+    const uint16_t *colours,
+    int32_t first,
+    int32_t count)
+{
+    if ((first < 0) || (count < 0) || (first + count > il->paletteSize))
+    {
+        return false;
+    }
+
+    if (count == 0)
+    {
+        return true;
+    }
+
+    memcpy(&(il->palette[first]), colours, count * sizeof(uint16_t));
+
+    int32_t i;
+    for (i = 0 ; i < il->numResources ; i++)
+    {
+        int result =
+        vc_dispmanx_resource_set_palette(il->resources[i],
+                                         &(il->palette[first]),
+                                         first * sizeof(uint16_t),
+                                         count * sizeof(uint16_t));
+        assert(result == 0);
+    }
+
+    return true;
 }
 
 //-------------------------------------------------------------------------
@@ -130,6 +433,27 @@ addElementImageLayerCentered(
     addElementImageLayer(il, display, update);
 }
 
+//-------------------------------------------------------------------------
+// Show the whole image in dest, the HVS scales it if the sizes differ.
+
+void
+addElementImageLayerDest(
+    IMAGE_LAYER_T *il,
+    const VC_RECT_T *dest,
+    DISPMANX_DISPLAY_HANDLE_T display,
+    DISPMANX_UPDATE_HANDLE_T update)
+{
+    vc_dispmanx_rect_set(&(il->srcRect),
+                         0 << 16,
+                         0 << 16,
+                         il->image.width << 16,
+                         il->image.height << 16);
+
+    il->dstRect = *dest;
+
+    addElementImageLayer(il, display, update);
+}
+
 //-------------------------------------------------------------------------
 
 void
@@ -138,10 +462,12 @@ addElementImageLayer(
     DISPMANX_DISPLAY_HANDLE_T display,
     DISPMANX_UPDATE_HANDLE_T update)
 {
+    // mix so the element opacity scales the per pixel alpha
+
     VC_DISPMANX_ALPHA_T alpha =
     {
-        DISPMANX_FLAGS_ALPHA_FROM_SOURCE, 
-        255, /*alpha 0->255*/
+        DISPMANX_FLAGS_ALPHA_FROM_SOURCE | DISPMANX_FLAGS_ALPHA_MIX,
+        il->opacity, /*alpha 0->255*/
         0
     };
 
@@ -155,108 +481,1104 @@ addElementImageLayer(
                                 DISPMANX_PROTECTION_NONE,
                                 &alpha,
                                 NULL, // clamp
-                                DISPMANX_NO_ROTATE);
+                                il->transform);
     assert(il->element != 0);
 }
 
 //-------------------------------------------------------------------------
 
-void
-changeSourceImageLayer(
+static void
+addDirtyBand(
+    int32_t *count,
+    VC_RECT_T *rects,
+    int32_t width,
+    int32_t top,
+    int32_t bottom)
+{
+    VC_RECT_T bands[IMAGE_LAYER_MAX_DIRTY_BANDS + 1];
+    int32_t used = 0;
+    bool inserted = false;
+
+    int32_t i;
+    for (i = 0 ; i < *count ; i++)
+    {
+        if ((inserted == false) && (top < rects[i].y))
+        {
+            vc_dispmanx_rect_set(&(bands[used++]), 0, top, width, bottom - top);
+            inserted = true;
+        }
+
+        bands[used++] = rects[i];
+    }
+
+    if (inserted == false)
+    {
+        vc_dispmanx_rect_set(&(bands[used++]), 0, top, width, bottom - top);
+    }
+
+    //---------------------------------------------------------------------
+    // merge bands that overlap or touch
+
+    int32_t last = 0;
+    for (i = 1 ; i < used ; i++)
+    {
+        int32_t lastBottom = bands[last].y + bands[last].height;
+
+        if (bands[i].y <= lastBottom)
+        {
+            int32_t bandBottom = bands[i].y + bands[i].height;
+
+            if (bandBottom > lastBottom)
+            {
+                bands[last].height = bandBottom - bands[last].y;
+            }
+        }
+        else
+        {
+            bands[++last] = bands[i];
+        }
+    }
+
+    used = last + 1;
+
+    //---------------------------------------------------------------------
+    // out of bands, fold the pair with the smallest gap into one
+
+    if (used > IMAGE_LAYER_MAX_DIRTY_BANDS)
+    {
+        int32_t closest = 0;
+        int32_t gap = INT32_MAX;
+
+        for (i = 0 ; i < used - 1 ; i++)
+        {
+            int32_t bandGap = bands[i + 1].y - (bands[i].y + bands[i].height);
+
+            if (bandGap < gap)
+            {
+                gap = bandGap;
+                closest = i;
+            }
+        }
+
+        bands[closest].height = bands[closest + 1].y
+                              + bands[closest + 1].height
+                              - bands[closest].y;
+
+        memmove(&(bands[closest + 1]),
+                &(bands[closest + 2]),
+                (used - closest - 2) * sizeof(VC_RECT_T));
+        used--;
+    }
+
+    memcpy(rects, bands, used * sizeof(VC_RECT_T));
+    *count = used;
+}
+
+//-------------------------------------------------------------------------
+
+bool
+markDirtyImageLayer(
     IMAGE_LAYER_T *il,
-    DISPMANX_UPDATE_HANDLE_T update)
+    const VC_RECT_T *rect)
 {
-    int result = vc_dispmanx_resource_write_data(il->resource,
-                                                 il->image.type,
-                                                 il->image.pitch,
-                                                 il->image.buffer,
-                                                 &(il->bmpRect));
-    assert(result == 0);
+    int32_t left = (rect->x < 0) ? 0 : rect->x;
+    int32_t right = rect->x + rect->width;
+    int32_t top = (rect->y < 0) ? 0 : rect->y;
+    int32_t bottom = rect->y + rect->height;
 
-    result = vc_dispmanx_element_change_source(update,
-                                               il->element,
-                                               il->resource);
-    assert(result == 0);
+    if (right > il->image.width)
+    {
+        right = il->image.width;
+    }
+
+    if (bottom > il->image.height)
+    {
+        bottom = il->image.height;
+    }
 
+    if ((left >= right) || (top >= bottom))
+    {
+        return false;
+    }
+
+    // vc_dispmanx_resource_write_data ignores the x coordinate of the rect
+    // and always transfers whole rows, so only the rows are tracked. A
+    // pipelined layer collects them for the next frame it hands over, the
+    // layer's own bands belong to the upload thread.
+
+    if (il->pipeline != NULL)
+    {
+        addDirtyBand(&(il->pipeline->dirtyBands),
+                     il->pipeline->dirtyRect,
+                     il->image.width,
+                     top,
+                     bottom);
+    }
+    else
+    {
+        addDirtyBand(&(il->dirtyBands),
+                     il->dirtyRect,
+                     il->image.width,
+                     top,
+                     bottom);
+    }
+
+    return true;
 }
 
 //-------------------------------------------------------------------------
 
-void
-changeSourceAndUpdateImageLayer(
+static void
+updateDone(
+    DISPMANX_UPDATE_HANDLE_T update,
+    void *arg)
+{
+    IMAGE_LAYER_T *il = arg;
+    uint64_t now = nowNs();
+
+    pthread_mutex_lock(&(il->pendingLock));
+
+    // updates complete in the order they were submitted
+
+    if (il->updatesSubmitted - il->updatesDone <= IMAGE_LAYER_MAX_TIMED_UPDATES)
+    {
+        uint64_t latency = now - il->submitNs[il->updatesDone % IMAGE_LAYER_MAX_TIMED_UPDATES];
+        int32_t bucket = 0;
+
+        while ((bucket < IMAGE_LAYER_LATENCY_BUCKETS - 1) &&
+               (latency >= (1000000ULL << bucket)))
+        {
+            bucket++;
+        }
+
+        il->stats.latency[bucket]++;
+    }
+
+    il->updatesDone++;
+    il->stats.framesPresented++;
+    il->pendingUpdates--;
+    pthread_cond_broadcast(&(il->pendingDone));
+    pthread_mutex_unlock(&(il->pendingLock));
+
+    if (il->notify != NULL)
+    {
+        il->notify(il->notifyArg);
+    }
+}
+
+//-------------------------------------------------------------------------
+// Completion of an update that only changed the element's attributes. It
+// still counts against the pending updates but is not a presented frame,
+// and is left out of the update latency.
+
+static void
+attributesDone(
+    DISPMANX_UPDATE_HANDLE_T update,
+    void *arg)
+{
+    IMAGE_LAYER_T *il = arg;
+
+    pthread_mutex_lock(&(il->pendingLock));
+    il->stats.attributeUpdates++;
+    il->pendingUpdates--;
+    pthread_cond_broadcast(&(il->pendingDone));
+    pthread_mutex_unlock(&(il->pendingLock));
+
+    if (il->notify != NULL)
+    {
+        il->notify(il->notifyArg);
+    }
+}
+
+//-------------------------------------------------------------------------
+
+static void
+addPendingImageLayer(
     IMAGE_LAYER_T *il)
 {
-    int result = vc_dispmanx_resource_write_data(il->resource,
-                                                 il->image.type,
-                                                 il->image.pitch,
-                                                 il->image.buffer,
-                                                 &(il->bmpRect));
-    assert(result == 0);
+    pthread_mutex_lock(&(il->pendingLock));
+    il->submitNs[il->updatesSubmitted % IMAGE_LAYER_MAX_TIMED_UPDATES] = nowNs();
+    il->updatesSubmitted++;
+    il->pendingUpdates++;
+    pthread_mutex_unlock(&(il->pendingLock));
+}
 
-    DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start(0);
-    assert(update != 0);
+//-------------------------------------------------------------------------
 
-    result = vc_dispmanx_element_change_source(update,
-                                               il->element,
-                                               il->resource);
-    assert(result == 0);
+typedef struct
+{
+    int32_t count;
+    IMAGE_LAYER_T *layers[];
+} IMAGE_LAYER_GROUP_T;
 
-    result = vc_dispmanx_update_submit_sync(update);
-    assert(result == 0);
+static void
+updateDoneGroup(
+    DISPMANX_UPDATE_HANDLE_T update,
+    void *arg)
+{
+    IMAGE_LAYER_GROUP_T *group = arg;
 
+    int32_t i;
+    for (i = 0 ; i < group->count ; i++)
+    {
+        updateDone(update, group->layers[i]);
+    }
+
+    free(group);
 }
 
 //-------------------------------------------------------------------------
 
 void
-moveImageLayer(
+waitForUpdatesImageLayer(
     IMAGE_LAYER_T *il,
-    int32_t xOffset,
-    int32_t yOffset,
-    DISPMANX_MODEINFO_T *info,
-    DISPMANX_UPDATE_HANDLE_T update)
+    int32_t maxPending)
 {
-    vc_dispmanx_rect_set(&(il->dstRect),
-                         xOffset,
-                         yOffset,
-                         info->width,
-                         info->height);
+    pthread_mutex_lock(&(il->pendingLock));
 
-    int result =
-    vc_dispmanx_element_change_attributes(update,
-                                          il->element,
-                                          ELEMENT_CHANGE_DEST_RECT,
-                                          0,
-                                          255,
-                                          &(il->dstRect),
-                                          &(il->srcRect),
-                                          0,
-                                          DISPMANX_NO_ROTATE);
-    assert(result == 0);
+    while (il->pendingUpdates > maxPending)
+    {
+        pthread_cond_wait(&(il->pendingDone), &(il->pendingLock));
+    }
+
+    pthread_mutex_unlock(&(il->pendingLock));
 }
 
 //-------------------------------------------------------------------------
+// Hash a block of rows. Each of the eight lanes stays a bijection of its
+// previous value for every word, so a single changed word always changes
+// the hash. The lanes are independent so the loop vectorises.
 
-void
-destroyImageLayer(
-    IMAGE_LAYER_T *il)
+static uint64_t
+hashRows(
+    const uint32_t * restrict words,
+    size_t count)
 {
-    int result = 0;
-
-    DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start(0);
-    assert(update != 0);
-    result = vc_dispmanx_element_remove(update, il->element);
-    assert(result == 0);
-    result = vc_dispmanx_update_submit_sync(update);
-    assert(result == 0);
+    uint32_t lane[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
 
-    //---------------------------------------------------------------------
+    size_t i;
+    for (i = 0 ; i < count ; i += 8)
+    {
+        int32_t j;
+        for (j = 0 ; j < 8 ; j++)
+        {
+            lane[j] = (lane[j] ^ words[i + j]) * 0x9E3779B1;
+        }
+    }
 
-    result = vc_dispmanx_resource_delete(il->resource);
-    assert(result == 0);
+    uint64_t hash = 0;
 
-    //---------------------------------------------------------------------
+    int32_t j;
+    for (j = 0 ; j < 8 ; j++)
+    {
+        hash = (hash * 0x9E3779B97F4A7C15ULL) + lane[j];
+    }
 
-    destroyImage(&(il->image));
+    return hash;
 }
 
+//-------------------------------------------------------------------------
+// Compare blocks of IMAGE_LAYER_HASH_ROWS rows with a hash of what was last
+// uploaded, so only the blocks that really changed are written. Intended
+// for applications that redraw everything and can't name dirty rectangles.
+// Whole rows are transferred anyway, so blocks span the full width.
+
+bool
+detectChangesImageLayer(
+    IMAGE_LAYER_T *il,
+    bool enable)
+{
+    free(il->blockHash);
+    il->blockHash = NULL;
+
+    if (enable)
+    {
+        int32_t blocks = il->image.alignedHeight / IMAGE_LAYER_HASH_ROWS;
+
+        il->blockHash = calloc(blocks, sizeof(uint64_t));
+
+        if (il->blockHash == NULL)
+        {
+            return false;
+        }
+
+        // nothing is known about what the resources hold yet
+
+        il->blockHashValid = false;
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------
+
+static bool
+findChangesInImage(
+    IMAGE_LAYER_T *il,
+    IMAGE_T *source,
+    int32_t *dirtyBands,
+    VC_RECT_T *dirtyRect)
+{
+    if (il->blockHash == NULL)
+    {
+        return true;
+    }
+
+    if (*dirtyBands == 0)
+    {
+        addDirtyBand(dirtyBands, dirtyRect, il->image.width, 0, il->image.height);
+    }
+
+    //---------------------------------------------------------------------
+    // only the blocks touching the dirty bands are hashed, or all of them
+    // the first time
+
+    int32_t blocks = il->image.alignedHeight / IMAGE_LAYER_HASH_ROWS;
+    bool candidate[blocks];
+    memset(candidate, il->blockHashValid == false, sizeof(candidate));
+
+    int32_t i;
+    for (i = 0 ; i < *dirtyBands ; i++)
+    {
+        int32_t first = dirtyRect[i].y / IMAGE_LAYER_HASH_ROWS;
+        int32_t last = (dirtyRect[i].y + dirtyRect[i].height - 1)
+                     / IMAGE_LAYER_HASH_ROWS;
+
+        int32_t block;
+        for (block = first ; block <= last ; block++)
+        {
+            candidate[block] = true;
+        }
+    }
+
+    *dirtyBands = 0;
+
+    size_t blockWords = (IMAGE_LAYER_HASH_ROWS * source->pitch) / sizeof(uint32_t);
+
+    for (i = 0 ; i < blocks ; i++)
+    {
+        if (candidate[i] == false)
+        {
+            continue;
+        }
+
+        const uint32_t *words = source->buffer;
+        uint64_t hash = hashRows(words + (i * blockWords), blockWords);
+
+        if ((il->blockHashValid == false) || (hash != il->blockHash[i]))
+        {
+            int32_t top = i * IMAGE_LAYER_HASH_ROWS;
+            int32_t bottom = top + IMAGE_LAYER_HASH_ROWS;
+
+            if (bottom > il->image.height)
+            {
+                bottom = il->image.height;
+            }
+
+            addDirtyBand(dirtyBands, dirtyRect, il->image.width, top, bottom);
+            il->blockHash[i] = hash;
+        }
+    }
+
+    il->blockHashValid = true;
+
+    return *dirtyBands > 0;
+}
+
+//-------------------------------------------------------------------------
+// With change detection on, narrow the dirty rows down to the blocks that
+// differ from the last upload. False if nothing changed, in which case the
+// caller should skip the update, as with no bands the whole image would be
+// written. Always true with detection off.
+
+bool
+findChangesImageLayer(
+    IMAGE_LAYER_T *il)
+{
+    if (il->pipeline != NULL)
+    {
+        return true;
+    }
+
+    return findChangesInImage(il, &(il->image), &(il->dirtyBands), il->dirtyRect);
+}
+
+//-------------------------------------------------------------------------
+// The back resource is still on screen until every update but the one
+// that replaced it has completed. With one or two resources that means
+// waiting for all of them.
+
+static int32_t
+maxPendingImageLayer(
+    IMAGE_LAYER_T *il)
+{
+    int32_t maxPending = il->numResources - 2;
+
+    if (maxPending < 0)
+    {
+        maxPending = 0;
+    }
+
+    return maxPending;
+}
+
+//-------------------------------------------------------------------------
+// True if the next update can be written without waiting for the display.
+
+bool
+readyForUpdateImageLayer(
+    IMAGE_LAYER_T *il)
+{
+    pthread_mutex_lock(&(il->pendingLock));
+    bool ready = il->pendingUpdates <= maxPendingImageLayer(il);
+    pthread_mutex_unlock(&(il->pendingLock));
+
+    return ready;
+}
+
+//-------------------------------------------------------------------------
+// Number of updates completed so far, the nth update submitted is on
+// screen once this reaches n.
+
+uint64_t
+updatesDoneImageLayer(
+    IMAGE_LAYER_T *il)
+{
+    pthread_mutex_lock(&(il->pendingLock));
+    uint64_t done = il->updatesDone;
+    pthread_mutex_unlock(&(il->pendingLock));
+
+    return done;
+}
+
+//-------------------------------------------------------------------------
+
+static DISPMANX_RESOURCE_HANDLE_T
+writeDirtyImageLayer(
+    IMAGE_LAYER_T *il,
+    IMAGE_T *source)
+{
+    if (il->dirtyBands == 0)
+    {
+        addDirtyBand(&(il->dirtyBands),
+                     il->dirtyRect,
+                     il->image.width,
+                     0,
+                     il->image.height);
+    }
+
+    waitForUpdatesImageLayer(il, maxPendingImageLayer(il));
+
+    //---------------------------------------------------------------------
+    // The other resources miss the new rows until they are next written.
+    // Rows merged in below from the back resource's own stale list are
+    // already current or stale everywhere else, passing them on again would
+    // keep them going back and forth between the resources for good.
+
+    int32_t back = il->backResource;
+    int32_t i;
+
+    for (i = 0 ; i < il->dirtyBands ; i++)
+    {
+        int32_t other;
+        for (other = 0 ; other < il->numResources ; other++)
+        {
+            if (other != back)
+            {
+                addDirtyBand(&(il->staleBands[other]),
+                             il->staleRect[other],
+                             il->image.width,
+                             il->dirtyRect[i].y,
+                             il->dirtyRect[i].y + il->dirtyRect[i].height);
+            }
+        }
+    }
+
+    //---------------------------------------------------------------------
+    // The back resource also misses whatever was written to the other
+    // resources since it was last shown.
+
+    for (i = 0 ; i < il->staleBands[back] ; i++)
+    {
+        addDirtyBand(&(il->dirtyBands),
+                     il->dirtyRect,
+                     il->image.width,
+                     il->staleRect[back][i].y,
+                     il->staleRect[back][i].y + il->staleRect[back][i].height);
+    }
+
+    il->staleBands[back] = 0;
+
+    for (i = 0 ; i < il->dirtyBands ; i++)
+    {
+        IMAGE_T *upload = uploadImageLayer(il,
+                                           source,
+                                           il->dirtyRect[i].y,
+                                           il->dirtyRect[i].height);
+
+        writeDataImageLayer(il, il->resources[back], upload, &(il->dirtyRect[i]));
+    }
+
+    il->dirtyBands = 0;
+    il->backResource = (back + 1) % il->numResources;
+    il->resource = il->resources[back];
+
+    return il->resource;
+}
+
+//-------------------------------------------------------------------------
+
+void
+changeSourceImageLayer(
+    IMAGE_LAYER_T *il,
+    DISPMANX_UPDATE_HANDLE_T update)
+{
+    DISPMANX_RESOURCE_HANDLE_T resource = writeDirtyImageLayer(il, &(il->image));
+
+    int result = vc_dispmanx_element_change_source(update,
+                                                   il->element,
+                                                   resource);
+    assert(result == 0);
+
+}
+
+//-------------------------------------------------------------------------
+
+void
+changeSourceAndUpdateImageLayer(
+    IMAGE_LAYER_T *il)
+{
+    DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start(0);
+    assert(update != 0);
+
+    changeSourceImageLayer(il, update);
+    submitUpdateImageLayer(il, update, true);
+}
+
+//-------------------------------------------------------------------------
+
+void
+submitUpdateImageLayer(
+    IMAGE_LAYER_T *il,
+    DISPMANX_UPDATE_HANDLE_T update,
+    bool wait)
+{
+    addPendingImageLayer(il);
+
+    int result = vc_dispmanx_update_submit(update, updateDone, il);
+    assert(result == 0);
+
+    if (wait)
+    {
+        waitForUpdatesImageLayer(il, 0);
+    }
+}
+
+//-------------------------------------------------------------------------
+
+void
+submitAttributesImageLayer(
+    IMAGE_LAYER_T *il,
+    DISPMANX_UPDATE_HANDLE_T update,
+    bool wait)
+{
+    pthread_mutex_lock(&(il->pendingLock));
+    il->pendingUpdates++;
+    pthread_mutex_unlock(&(il->pendingLock));
+
+    int result = vc_dispmanx_update_submit(update, attributesDone, il);
+    assert(result == 0);
+
+    if (wait)
+    {
+        waitForUpdatesImageLayer(il, 0);
+    }
+}
+
+//-------------------------------------------------------------------------
+
+void
+submitUpdateImageLayers(
+    IMAGE_LAYER_T **layers,
+    int32_t count,
+    DISPMANX_UPDATE_HANDLE_T update,
+    bool wait)
+{
+    IMAGE_LAYER_GROUP_T *group =
+        malloc(sizeof(IMAGE_LAYER_GROUP_T) + count * sizeof(IMAGE_LAYER_T*));
+
+    if (group == NULL)
+    {
+        fprintf(stderr, "imageLayer: memory exhausted\n");
+        exit(EXIT_FAILURE);
+    }
+
+    group->count = count;
+
+    int32_t i;
+    for (i = 0 ; i < count ; i++)
+    {
+        group->layers[i] = layers[i];
+
+        addPendingImageLayer(layers[i]);
+    }
+
+    int result = vc_dispmanx_update_submit(update, updateDoneGroup, group);
+    assert(result == 0);
+
+    if (wait)
+    {
+        for (i = 0 ; i < count ; i++)
+        {
+            waitForUpdatesImageLayer(layers[i], 0);
+        }
+    }
+}
+
+//-------------------------------------------------------------------------
+// Count an update that was dropped because nothing visible changed.
+
+void
+skipUpdateImageLayer(
+    IMAGE_LAYER_T *il)
+{
+    pthread_mutex_lock(&(il->pendingLock));
+    il->stats.framesSkipped++;
+    pthread_mutex_unlock(&(il->pendingLock));
+}
+
+//-------------------------------------------------------------------------
+
+#define PIPELINE_FRESH 0x100
+
+static void *
+pipelineThread(
+    void *arg)
+{
+    IMAGE_LAYER_T *il = arg;
+    IMAGE_LAYER_PIPELINE_T *pl = il->pipeline;
+    uint64_t lastSequence = 0;
+
+    while (true)
+    {
+        if ((sem_wait(&(pl->wake)) != 0) && (errno == EINTR))
+        {
+            continue;
+        }
+
+        if (atomic_load(&(pl->stop)))
+        {
+            break;
+        }
+
+        // only this thread clears the fresh flag, so a fresh frame seen
+        // here is still there to take, or has been replaced by a newer one
+
+        if ((atomic_load(&(pl->readyFrame)) & PIPELINE_FRESH) == 0)
+        {
+            continue;
+        }
+
+        int32_t taken = atomic_exchange(&(pl->readyFrame), pl->uploadFrame);
+        pl->uploadFrame = taken & ~PIPELINE_FRESH;
+
+        IMAGE_LAYER_FRAME_T *frame = &(pl->frames[pl->uploadFrame]);
+        atomic_store(&(pl->takenSequence), frame->sequence);
+
+        //-----------------------------------------------------------------
+        // frames published since the last one taken were replaced in the
+        // hand-off slot before this thread got to them
+
+        if (frame->sequence - lastSequence > 1)
+        {
+            pthread_mutex_lock(&(il->pendingLock));
+            il->stats.framesSkipped += frame->sequence - lastSequence - 1;
+            pthread_mutex_unlock(&(il->pendingLock));
+        }
+
+        lastSequence = frame->sequence;
+
+        memcpy(il->dirtyRect,
+               frame->dirtyRect,
+               frame->dirtyBands * sizeof(VC_RECT_T));
+        il->dirtyBands = frame->dirtyBands;
+
+        DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start(0);
+        assert(update != 0);
+
+        DISPMANX_RESOURCE_HANDLE_T resource =
+            writeDirtyImageLayer(il, &(frame->image));
+
+        int result = vc_dispmanx_element_change_source(update,
+                                                       il->element,
+                                                       resource);
+        assert(result == 0);
+
+        submitUpdateImageLayer(il, update, false);
+    }
+
+    return NULL;
+}
+
+//-------------------------------------------------------------------------
+// Upload the layer from a thread of its own. The image stays where the
+// application draws, publishImageLayer copies the dirty rows into a spare
+// CPU frame and swaps it into the hand-off slot, where the upload thread
+// picks up the newest one. A frame still waiting in the slot when the next
+// is published is dropped and its rows carried into the newer frame. Must
+// be called after the element has been added.
+
+bool
+startPipelineImageLayer(
+    IMAGE_LAYER_T *il)
+{
+    IMAGE_LAYER_PIPELINE_T *pl = calloc(1, sizeof(IMAGE_LAYER_PIPELINE_T));
+
+    if (pl == NULL)
+    {
+        return false;
+    }
+
+    int32_t i;
+    for (i = 0 ; i < IMAGE_LAYER_PIPELINE_FRAMES ; i++)
+    {
+        if (initImage(&(pl->frames[i].image),
+                      il->image.type,
+                      il->image.width,
+                      il->image.height,
+                      false) == false)
+        {
+            while (--i >= 0)
+            {
+                destroyImage(&(pl->frames[i].image));
+            }
+
+            free(pl);
+            return false;
+        }
+    }
+
+    pl->drawFrame = 0;
+    pl->uploadFrame = 1;
+    atomic_init(&(pl->readyFrame), 2);
+    atomic_init(&(pl->takenSequence), 0);
+    atomic_init(&(pl->stop), false);
+    pl->sequence = 0;
+    sem_init(&(pl->wake), 0, 0);
+
+    // the frames start out blank, the image may not
+
+    for (i = 0 ; i < IMAGE_LAYER_PIPELINE_FRAMES ; i++)
+    {
+        addDirtyBand(&(pl->staleBands[i]),
+                     pl->staleRect[i],
+                     il->image.width,
+                     0,
+                     il->image.height);
+    }
+
+    il->pipeline = pl;
+
+    if (pthread_create(&(pl->thread), NULL, pipelineThread, il) != 0)
+    {
+        il->pipeline = NULL;
+        sem_destroy(&(pl->wake));
+
+        for (i = 0 ; i < IMAGE_LAYER_PIPELINE_FRAMES ; i++)
+        {
+            destroyImage(&(pl->frames[i].image));
+        }
+
+        free(pl);
+        return false;
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------
+// Hand the rows marked since the last call to the upload thread, all of
+// them if none were marked. Never waits for the GPU. With change detection
+// the image is compared here, before anything is copied, and false is
+// returned if nothing changed.
+
+bool
+publishImageLayer(
+    IMAGE_LAYER_T *il)
+{
+    IMAGE_LAYER_PIPELINE_T *pl = il->pipeline;
+    IMAGE_LAYER_FRAME_T *frame = &(pl->frames[pl->drawFrame]);
+
+    if (findChangesInImage(il, &(il->image), &(pl->dirtyBands), pl->dirtyRect) == false)
+    {
+        skipUpdateImageLayer(il);
+        return false;
+    }
+
+    if (pl->dirtyBands == 0)
+    {
+        addDirtyBand(&(pl->dirtyBands),
+                     pl->dirtyRect,
+                     il->image.width,
+                     0,
+                     il->image.height);
+    }
+
+    //---------------------------------------------------------------------
+    // Unless the previous frame has been taken it may yet be dropped, so
+    // its rows go out again with this one. Frames that were taken carry
+    // everything since the one before them.
+
+    uint64_t sequence = ++(pl->sequence);
+
+    if (atomic_load(&(pl->takenSequence)) + 1 == sequence)
+    {
+        pl->publishedBands = 0;
+    }
+
+    int32_t i;
+    for (i = 0 ; i < pl->dirtyBands ; i++)
+    {
+        addDirtyBand(&(pl->publishedBands),
+                     pl->publishedRect,
+                     il->image.width,
+                     pl->dirtyRect[i].y,
+                     pl->dirtyRect[i].y + pl->dirtyRect[i].height);
+
+        int32_t f;
+        for (f = 0 ; f < IMAGE_LAYER_PIPELINE_FRAMES ; f++)
+        {
+            addDirtyBand(&(pl->staleBands[f]),
+                         pl->staleRect[f],
+                         il->image.width,
+                         pl->dirtyRect[i].y,
+                         pl->dirtyRect[i].y + pl->dirtyRect[i].height);
+        }
+    }
+
+    pl->dirtyBands = 0;
+
+    //---------------------------------------------------------------------
+    // Every published frame is a whole copy of the image. Besides the dirty
+    // rows the upload thread writes the back resource's stale rows, which
+    // may have changed in any frame since, so the frame gets every row that
+    // changed since it was last drawn into, not just the published ones.
+
+    int32_t draw = pl->drawFrame;
+
+    for (i = 0 ; i < pl->staleBands[draw] ; i++)
+    {
+        int32_t offset = pl->staleRect[draw][i].y * il->image.pitch;
+
+        memcpy((uint8_t *)(frame->image.buffer) + offset,
+               (uint8_t *)(il->image.buffer) + offset,
+               pl->staleRect[draw][i].height * il->image.pitch);
+    }
+
+    pl->staleBands[draw] = 0;
+
+    memcpy(frame->dirtyRect,
+           pl->publishedRect,
+           pl->publishedBands * sizeof(VC_RECT_T));
+    frame->dirtyBands = pl->publishedBands;
+    frame->sequence = sequence;
+
+    //---------------------------------------------------------------------
+    // A frame that was still fresh already has a wake up pending for it.
+
+    int32_t previous = atomic_exchange(&(pl->readyFrame),
+                                       pl->drawFrame | PIPELINE_FRESH);
+    pl->drawFrame = previous & ~PIPELINE_FRESH;
+
+    if ((previous & PIPELINE_FRESH) == 0)
+    {
+        sem_post(&(pl->wake));
+    }
+
+    return true;
+}
+
+//-------------------------------------------------------------------------
+// Stop the upload thread, a frame still waiting in the hand-off slot is
+// dropped.
+
+void
+stopPipelineImageLayer(
+    IMAGE_LAYER_T *il)
+{
+    IMAGE_LAYER_PIPELINE_T *pl = il->pipeline;
+
+    if (pl == NULL)
+    {
+        return;
+    }
+
+    atomic_store(&(pl->stop), true);
+    sem_post(&(pl->wake));
+    pthread_join(pl->thread, NULL);
+    sem_destroy(&(pl->wake));
+
+    int32_t i;
+    for (i = 0 ; i < IMAGE_LAYER_PIPELINE_FRAMES ; i++)
+    {
+        destroyImage(&(pl->frames[i].image));
+    }
+
+    free(pl);
+    il->pipeline = NULL;
+}
+
+//-------------------------------------------------------------------------
+// Copy the counters. The upload counters are updated by whoever is writing
+// to the layer and the rest by the completion callbacks, all of them under
+// pendingLock.
+
+void
+getStatsImageLayer(
+    IMAGE_LAYER_T *il,
+    IMAGE_LAYER_STATS_T *stats)
+{
+    pthread_mutex_lock(&(il->pendingLock));
+    *stats = il->stats;
+    pthread_mutex_unlock(&(il->pendingLock));
+}
+
+//-------------------------------------------------------------------------
+
+void
+resetStatsImageLayer(
+    IMAGE_LAYER_T *il)
+{
+    pthread_mutex_lock(&(il->pendingLock));
+    memset(&(il->stats), 0, sizeof(il->stats));
+    pthread_mutex_unlock(&(il->pendingLock));
+}
+
+//-------------------------------------------------------------------------
+
+void
+addStatsImageLayer(
+    IMAGE_LAYER_STATS_T *total,
+    const IMAGE_LAYER_STATS_T *stats)
+{
+    total->bytesUploaded += stats->bytesUploaded;
+    total->writes += stats->writes;
+    total->writeNs += stats->writeNs;
+    total->framesPresented += stats->framesPresented;
+    total->framesSkipped += stats->framesSkipped;
+    total->attributeUpdates += stats->attributeUpdates;
+
+    if (stats->maxWriteNs > total->maxWriteNs)
+    {
+        total->maxWriteNs = stats->maxWriteNs;
+    }
+
+    int32_t i;
+    for (i = 0 ; i < IMAGE_LAYER_LATENCY_BUCKETS ; i++)
+    {
+        total->latency[i] += stats->latency[i];
+    }
+}
+
+//-------------------------------------------------------------------------
+// Move the layer, it keeps the size it is shown at.
+
+void
+moveImageLayer(
+    IMAGE_LAYER_T *il,
+    int32_t xOffset,
+    int32_t yOffset,
+    DISPMANX_UPDATE_HANDLE_T update)
+{
+    il->dstRect.x = xOffset;
+    il->dstRect.y = yOffset;
+
+    changeAttributesImageLayer(il, ELEMENT_CHANGE_DEST_RECT, update);
+}
+
+//-------------------------------------------------------------------------
+// Send the layer, opacity and rectangles selected by the ELEMENT_CHANGE_*
+// flags from the image layer to its element, without uploading any pixels.
+
+void
+changeAttributesImageLayer(
+    IMAGE_LAYER_T *il,
+    uint32_t changeFlags,
+    DISPMANX_UPDATE_HANDLE_T update)
+{
+    int result =
+    vc_dispmanx_element_change_attributes(update,
+                                          il->element,
+                                          changeFlags,
+                                          il->layer,
+                                          il->opacity,
+                                          &(il->dstRect),
+                                          &(il->srcRect),
+                                          0,
+                                          il->transform);
+    assert(result == 0);
+}
+
+//-------------------------------------------------------------------------
+
+void
+destroyImageLayer(
+    IMAGE_LAYER_T *il)
+{
+    int result = 0;
+
+    stopPipelineImageLayer(il);
+    waitForUpdatesImageLayer(il, 0);
+
+    DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start(0);
+    assert(update != 0);
+    result = vc_dispmanx_element_remove(update, il->element);
+    assert(result == 0);
+    result = vc_dispmanx_update_submit_sync(update);
+    assert(result == 0);
+
+    //---------------------------------------------------------------------
+
+    IMAGE_T *upload = (il->convert) ? &(il->upload) : &(il->image);
+
+    int32_t i;
+    for (i = 0 ; i < il->numResources ; i++)
+    {
+        giveResourcePool(upload, il->resources[i]);
+    }
+
+    pthread_cond_destroy(&(il->pendingDone));
+    pthread_mutex_destroy(&(il->pendingLock));
+
+    //---------------------------------------------------------------------
+
+    destroyImagesImageLayer(il);
+}
+
+//-------------------------------------------------------------------------
+// Give back the images, the shared memory block and the change hashes. On
+// its own it is for a layer whose resources were never created.
+
+void
+destroyImagesImageLayer(
+    IMAGE_LAYER_T *il)
+{
+    free(il->blockHash);
+    il->blockHash = NULL;
+
+    if (il->sharedHandle != 0)
+    {
+        vcsm_unlock_hdl(il->sharedHandle);
+        vcsm_free(il->sharedHandle);
+        il->sharedHandle = 0;
+        il->image.buffer = NULL;
+    }
+
+    destroyImagePool(&(il->image));
+
+    if (il->convert)
+    {
+        destroyImagePool(&(il->upload));
+        il->convert = false;
+    }
+}
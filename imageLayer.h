@@ -28,9 +28,100 @@
 #ifndef IMAGE_LAYER_H
 #define IMAGE_LAYER_H
 
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
 #include "image.h"
 
 #include "bcm_host.h"
+#include "user-vcsm.h"
+
+//-------------------------------------------------------------------------
+
+// maximum number of separate row bands tracked before the closest ones are
+// folded together
+
+#define IMAGE_LAYER_MAX_DIRTY_BANDS 16
+
+// maximum number of resources a layer can cycle through
+
+#define IMAGE_LAYER_MAX_RESOURCES 3
+
+// update latency histogram buckets, bucket i counts latencies below
+// 2^i milliseconds and the last one everything slower
+
+#define IMAGE_LAYER_LATENCY_BUCKETS 8
+
+// submit times kept to measure the latency of updates still in flight
+
+#define IMAGE_LAYER_MAX_TIMED_UPDATES 8
+
+// CPU frames a pipelined layer passes between the drawing thread, the
+// upload thread and the hand-off slot between them
+
+#define IMAGE_LAYER_PIPELINE_FRAMES 3
+
+// palette entries of an 8BPP layer, 4BPP layers use the first 16
+
+#define IMAGE_LAYER_MAX_PALETTE 256
+
+// rows hashed together when looking for changes, a multiple of
+// IMAGE_HEIGHT_ALIGN so every block lies inside the buffer
+
+#define IMAGE_LAYER_HASH_ROWS 16
+
+//-------------------------------------------------------------------------
+
+typedef struct
+{
+    uint64_t bytesUploaded;
+    uint64_t writes;
+    uint64_t writeNs;
+    uint64_t maxWriteNs;
+    uint64_t latency[IMAGE_LAYER_LATENCY_BUCKETS];
+    uint64_t framesPresented;
+    uint64_t framesSkipped;
+    uint64_t attributeUpdates;
+} IMAGE_LAYER_STATS_T;
+
+//-------------------------------------------------------------------------
+
+// called on the dispmanx thread whenever an update of the layer completes
+
+typedef void (*IMAGE_LAYER_NOTIFY_T)(void *arg);
+
+//-------------------------------------------------------------------------
+
+typedef struct
+{
+    IMAGE_T image;
+    uint64_t sequence;
+    int32_t dirtyBands;
+    VC_RECT_T dirtyRect[IMAGE_LAYER_MAX_DIRTY_BANDS];
+} IMAGE_LAYER_FRAME_T;
+
+// The drawing thread owns drawFrame and the upload thread uploadFrame, the
+// third frame sits in readyFrame and is swapped atomically by both sides.
+
+typedef struct
+{
+    IMAGE_LAYER_FRAME_T frames[IMAGE_LAYER_PIPELINE_FRAMES];
+    int32_t drawFrame;
+    int32_t uploadFrame;
+    atomic_int readyFrame;
+    atomic_uint_fast64_t takenSequence;
+    uint64_t sequence;
+    int32_t dirtyBands;
+    VC_RECT_T dirtyRect[IMAGE_LAYER_MAX_DIRTY_BANDS];
+    int32_t publishedBands;
+    VC_RECT_T publishedRect[IMAGE_LAYER_MAX_DIRTY_BANDS];
+    int32_t staleBands[IMAGE_LAYER_PIPELINE_FRAMES];
+    VC_RECT_T staleRect[IMAGE_LAYER_PIPELINE_FRAMES][IMAGE_LAYER_MAX_DIRTY_BANDS];
+    sem_t wake;
+    atomic_bool stop;
+    pthread_t thread;
+} IMAGE_LAYER_PIPELINE_T;
 
 //-------------------------------------------------------------------------
 
@@ -41,8 +132,35 @@ typedef struct
     VC_RECT_T srcRect;
     VC_RECT_T dstRect;
     int32_t layer;
+    uint8_t opacity;
+    DISPMANX_TRANSFORM_T transform;
     DISPMANX_RESOURCE_HANDLE_T resource;
     DISPMANX_ELEMENT_HANDLE_T element;
+    int32_t dirtyBands;
+    VC_RECT_T dirtyRect[IMAGE_LAYER_MAX_DIRTY_BANDS];
+    int32_t numResources;
+    int32_t backResource;
+    DISPMANX_RESOURCE_HANDLE_T resources[IMAGE_LAYER_MAX_RESOURCES];
+    int32_t staleBands[IMAGE_LAYER_MAX_RESOURCES];
+    VC_RECT_T staleRect[IMAGE_LAYER_MAX_RESOURCES][IMAGE_LAYER_MAX_DIRTY_BANDS];
+    int32_t pendingUpdates;
+    pthread_mutex_t pendingLock;
+    pthread_cond_t pendingDone;
+    bool convert;
+    IMAGE_T upload;
+    IMAGE_LAYER_STATS_T stats;
+    uint64_t updatesSubmitted;
+    uint64_t updatesDone;
+    uint64_t submitNs[IMAGE_LAYER_MAX_TIMED_UPDATES];
+    IMAGE_LAYER_PIPELINE_T *pipeline;
+    IMAGE_LAYER_NOTIFY_T notify;
+    void *notifyArg;
+    uint64_t *blockHash;
+    bool blockHashValid;
+    unsigned int sharedHandle;
+    VCHI_MEM_HANDLE_T sharedVcHandle;
+    int32_t paletteSize;
+    uint16_t palette[IMAGE_LAYER_MAX_PALETTE];
 } IMAGE_LAYER_T;
 
 //-------------------------------------------------------------------------
@@ -54,11 +172,26 @@ initImageLayer(
     int32_t height,
     VC_IMAGE_TYPE_T type);
 
+bool
+convertImageLayer(
+    IMAGE_LAYER_T *il,
+    VC_IMAGE_TYPE_T type);
+
+bool
+shareImageLayer(
+    IMAGE_LAYER_T *il);
+
 void
 createResourceImageLayer(
     IMAGE_LAYER_T *il,
     int32_t layer);
 
+void
+createResourcesImageLayer(
+    IMAGE_LAYER_T *il,
+    int32_t layer,
+    int32_t numResources);
+
 void
 addElementImageLayerOffset(
     IMAGE_LAYER_T *il,
@@ -75,12 +208,31 @@ addElementImageLayerCentered(
     DISPMANX_DISPLAY_HANDLE_T display,
     DISPMANX_UPDATE_HANDLE_T update);
 
+void
+addElementImageLayerDest(
+    IMAGE_LAYER_T *il,
+    const VC_RECT_T *dest,
+    DISPMANX_DISPLAY_HANDLE_T display,
+    DISPMANX_UPDATE_HANDLE_T update);
+
 void
 addElementImageLayer(
     IMAGE_LAYER_T *il,
     DISPMANX_DISPLAY_HANDLE_T display,
     DISPMANX_UPDATE_HANDLE_T update);
 
+bool
+setPaletteImageLayer(
+    IMAGE_LAYER_T *il,
+    const uint16_t *colours,
+    int32_t first,
+    int32_t count);
+
+bool
+markDirtyImageLayer(
+    IMAGE_LAYER_T *il,
+    const VC_RECT_T *rect);
+
 void
 changeSourceImageLayer(
     IMAGE_LAYER_T *il,
@@ -90,17 +242,98 @@ void
 changeSourceAndUpdateImageLayer(
     IMAGE_LAYER_T *il);
 
+void
+submitUpdateImageLayer(
+    IMAGE_LAYER_T *il,
+    DISPMANX_UPDATE_HANDLE_T update,
+    bool wait);
+
+// submit an update that only changes the element's attributes, it is
+// counted in attributeUpdates instead of the presented frames
+
+void
+submitAttributesImageLayer(
+    IMAGE_LAYER_T *il,
+    DISPMANX_UPDATE_HANDLE_T update,
+    bool wait);
+
+void
+submitUpdateImageLayers(
+    IMAGE_LAYER_T **layers,
+    int32_t count,
+    DISPMANX_UPDATE_HANDLE_T update,
+    bool wait);
+
+void
+waitForUpdatesImageLayer(
+    IMAGE_LAYER_T *il,
+    int32_t maxPending);
+
+bool
+detectChangesImageLayer(
+    IMAGE_LAYER_T *il,
+    bool enable);
+
+bool
+findChangesImageLayer(
+    IMAGE_LAYER_T *il);
+
+bool
+readyForUpdateImageLayer(
+    IMAGE_LAYER_T *il);
+
+uint64_t
+updatesDoneImageLayer(
+    IMAGE_LAYER_T *il);
+
+void
+skipUpdateImageLayer(
+    IMAGE_LAYER_T *il);
+
+bool
+startPipelineImageLayer(
+    IMAGE_LAYER_T *il);
+
+bool
+publishImageLayer(
+    IMAGE_LAYER_T *il);
+
+void
+stopPipelineImageLayer(
+    IMAGE_LAYER_T *il);
+
+void
+getStatsImageLayer(
+    IMAGE_LAYER_T *il,
+    IMAGE_LAYER_STATS_T *stats);
+
+void
+resetStatsImageLayer(
+    IMAGE_LAYER_T *il);
+
+void
+addStatsImageLayer(
+    IMAGE_LAYER_STATS_T *total,
+    const IMAGE_LAYER_STATS_T *stats);
+
 void
 moveImageLayer(
     IMAGE_LAYER_T *il,
     int32_t xOffset,
     int32_t yOffset,
-    DISPMANX_MODEINFO_T *info,
+    DISPMANX_UPDATE_HANDLE_T update);
+
+void
+changeAttributesImageLayer(
+    IMAGE_LAYER_T *il,
+    uint32_t changeFlags,
     DISPMANX_UPDATE_HANDLE_T update);
 
 
 void destroyImageLayer(IMAGE_LAYER_T *il);
 
+void destroyImagesImageLayer(IMAGE_LAYER_T *il);
+
 //-------------------------------------------------------------------------
 
 #endif
@@ -0,0 +1,367 @@
+//-------------------------------------------------------------------------
+//
+// The MIT License (MIT)
+//
+// Copyright (c) 2013 Andrew Duncan
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//-------------------------------------------------------------------------
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+#include "pool.h"
+
+//-------------------------------------------------------------------------
+
+typedef struct POOL_ENTRY_T_ POOL_ENTRY_T;
+
+struct POOL_ENTRY_T_
+{
+    VC_IMAGE_TYPE_T type;
+    int32_t width;
+    int32_t height;
+    int32_t pitch;
+    int32_t alignedHeight;
+    DISPMANX_RESOURCE_HANDLE_T resource;
+    void *buffer;
+    POOL_ENTRY_T *next;
+};
+
+// entries are kept newest first, reused from the front and trimmed from
+// the back
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static POOL_ENTRY_T *entries = NULL;
+static POOL_STATS_T poolStats;
+
+//-------------------------------------------------------------------------
+
+static uint64_t
+entryBytes(
+    const POOL_ENTRY_T *entry)
+{
+    return (uint64_t)(entry->pitch) * entry->alignedHeight;
+}
+
+//-------------------------------------------------------------------------
+
+static bool
+matchEntry(
+    const POOL_ENTRY_T *entry,
+    const IMAGE_T *image,
+    bool resource)
+{
+    return ((entry->resource != 0) == resource) &&
+           (entry->type == image->type) &&
+           (entry->width == image->width) &&
+           (entry->height == image->height) &&
+           (entry->pitch == image->pitch) &&
+           (entry->alignedHeight == image->alignedHeight);
+}
+
+//-------------------------------------------------------------------------
+// Remove the newest entry matching the image, NULL if there is none.
+
+static POOL_ENTRY_T *
+takeEntry(
+    const IMAGE_T *image,
+    bool resource)
+{
+    pthread_mutex_lock(&poolLock);
+
+    POOL_ENTRY_T **link = &entries;
+
+    while ((*link != NULL) && (matchEntry(*link, image, resource) == false))
+    {
+        link = &((*link)->next);
+    }
+
+    POOL_ENTRY_T *entry = *link;
+
+    if (entry != NULL)
+    {
+        *link = entry->next;
+        poolStats.bytes -= entryBytes(entry);
+        if (resource)
+        {
+            poolStats.resources--;
+        }
+        else
+        {
+            poolStats.buffers--;
+        }
+        poolStats.hits++;
+    }
+    else
+    {
+        poolStats.misses++;
+    }
+
+    pthread_mutex_unlock(&poolLock);
+
+    return entry;
+}
+
+//-------------------------------------------------------------------------
+// Keep a resource or buffer for the image if it fits under the limit.
+
+static bool
+giveEntry(
+    const IMAGE_T *image,
+    DISPMANX_RESOURCE_HANDLE_T resource,
+    void *buffer)
+{
+    POOL_ENTRY_T *entry = malloc(sizeof(POOL_ENTRY_T));
+
+    if (entry == NULL)
+    {
+        return false;
+    }
+
+    entry->type = image->type;
+    entry->width = image->width;
+    entry->height = image->height;
+    entry->pitch = image->pitch;
+    entry->alignedHeight = image->alignedHeight;
+    entry->resource = resource;
+    entry->buffer = buffer;
+
+    pthread_mutex_lock(&poolLock);
+
+    bool kept = (poolStats.bytes + entryBytes(entry) <= poolStats.limit);
+
+    if (kept)
+    {
+        entry->next = entries;
+        entries = entry;
+        poolStats.bytes += entryBytes(entry);
+        if (resource != 0)
+        {
+            poolStats.resources++;
+        }
+        else
+        {
+            poolStats.buffers++;
+        }
+    }
+
+    pthread_mutex_unlock(&poolLock);
+
+    if (kept == false)
+    {
+        free(entry);
+    }
+
+    return kept;
+}
+
+//-------------------------------------------------------------------------
+
+static void
+freeEntry(
+    POOL_ENTRY_T *entry)
+{
+    if (entry->resource != 0)
+    {
+        int result = vc_dispmanx_resource_delete(entry->resource);
+        assert(result == 0);
+    }
+    else
+    {
+        free(entry->buffer);
+    }
+
+    free(entry);
+}
+
+//-------------------------------------------------------------------------
+// Like initImage, but reuse a pooled buffer of the same geometry. The
+// buffer is cleared either way.
+
+bool
+initImagePool(
+    IMAGE_T *image,
+    VC_IMAGE_TYPE_T type,
+    int32_t width,
+    int32_t height,
+    bool dither)
+{
+    if (initImageGeometry(image, type, width, height, dither) == false)
+    {
+        return false;
+    }
+
+    POOL_ENTRY_T *entry = takeEntry(image, false);
+
+    if (entry == NULL)
+    {
+        return initImage(image, type, width, height, dither);
+    }
+
+    image->buffer = entry->buffer;
+    free(entry);
+
+    memset(image->buffer, 0, image->size);
+
+    return true;
+}
+
+//-------------------------------------------------------------------------
+
+void
+destroyImagePool(
+    IMAGE_T *image)
+{
+    if ((image->buffer != NULL) && giveEntry(image, 0, image->buffer))
+    {
+        image->buffer = NULL;
+    }
+
+    destroyImage(image);
+}
+
+//-------------------------------------------------------------------------
+// A resource laid out like the image, reused from the pool if possible.
+
+DISPMANX_RESOURCE_HANDLE_T
+takeResourcePool(
+    const IMAGE_T *image)
+{
+    POOL_ENTRY_T *entry = takeEntry(image, true);
+
+    if (entry != NULL)
+    {
+        DISPMANX_RESOURCE_HANDLE_T resource = entry->resource;
+        free(entry);
+        return resource;
+    }
+
+    uint32_t vc_image_ptr;
+
+    DISPMANX_RESOURCE_HANDLE_T resource =
+        vc_dispmanx_resource_create(
+            image->type,
+            image->width | (image->pitch << 16),
+            image->height | (image->alignedHeight << 16),
+            &vc_image_ptr);
+    assert(resource != 0);
+
+    return resource;
+}
+
+//-------------------------------------------------------------------------
+// The resource must no longer be shown by any element.
+
+void
+giveResourcePool(
+    const IMAGE_T *image,
+    DISPMANX_RESOURCE_HANDLE_T resource)
+{
+    if (giveEntry(image, resource, NULL) == false)
+    {
+        int result = vc_dispmanx_resource_delete(resource);
+        assert(result == 0);
+    }
+}
+
+//-------------------------------------------------------------------------
+
+void
+setLimitPool(
+    uint64_t limit)
+{
+    pthread_mutex_lock(&poolLock);
+    poolStats.limit = limit;
+    pthread_mutex_unlock(&poolLock);
+
+    trimPool(limit);
+}
+
+//-------------------------------------------------------------------------
+// Free the oldest entries until the pool holds no more than bytes,
+// returning the number of bytes freed.
+
+uint64_t
+trimPool(
+    uint64_t bytes)
+{
+    POOL_ENTRY_T *freed = NULL;
+    uint64_t freedBytes = 0;
+
+    pthread_mutex_lock(&poolLock);
+
+    while (poolStats.bytes > bytes)
+    {
+        POOL_ENTRY_T **link = &entries;
+
+        while ((*link)->next != NULL)
+        {
+            link = &((*link)->next);
+        }
+
+        POOL_ENTRY_T *entry = *link;
+        *link = NULL;
+
+        poolStats.bytes -= entryBytes(entry);
+        if (entry->resource != 0)
+        {
+            poolStats.resources--;
+        }
+        else
+        {
+            poolStats.buffers--;
+        }
+
+        freedBytes += entryBytes(entry);
+        entry->next = freed;
+        freed = entry;
+    }
+
+    pthread_mutex_unlock(&poolLock);
+
+    // resources are deleted outside the lock as that waits on the GPU
+
+    while (freed != NULL)
+    {
+        POOL_ENTRY_T *next = freed->next;
+        freeEntry(freed);
+        freed = next;
+    }
+
+    return freedBytes;
+}
+
+//-------------------------------------------------------------------------
+
+void
+getStatsPool(
+    POOL_STATS_T *stats)
+{
+    pthread_mutex_lock(&poolLock);
+    *stats = poolStats;
+    pthread_mutex_unlock(&poolLock);
+}
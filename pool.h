@@ -0,0 +1,92 @@
+//-------------------------------------------------------------------------
+//
+// The MIT License (MIT)
+//
+// Copyright (c) 2013 Andrew Duncan
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//-------------------------------------------------------------------------
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "image.h"
+
+#include "bcm_host.h"
+
+//-------------------------------------------------------------------------
+
+// Resources and image buffers given back to the pool are kept, up to the
+// byte limit, and handed out again to the next image of the same type and
+// geometry instead of being allocated afresh. The limit starts at 0, which
+// frees everything straight away as before.
+
+typedef struct
+{
+    uint32_t resources;
+    uint32_t buffers;
+    uint64_t bytes;
+    uint64_t limit;
+    uint64_t hits;
+    uint64_t misses;
+} POOL_STATS_T;
+
+//-------------------------------------------------------------------------
+
+bool
+initImagePool(
+    IMAGE_T *image,
+    VC_IMAGE_TYPE_T type,
+    int32_t width,
+    int32_t height,
+    bool dither);
+
+void
+destroyImagePool(
+    IMAGE_T *image);
+
+DISPMANX_RESOURCE_HANDLE_T
+takeResourcePool(
+    const IMAGE_T *image);
+
+void
+giveResourcePool(
+    const IMAGE_T *image,
+    DISPMANX_RESOURCE_HANDLE_T resource);
+
+void
+setLimitPool(
+    uint64_t limit);
+
+uint64_t
+trimPool(
+    uint64_t bytes);
+
+void
+getStatsPool(
+    POOL_STATS_T *stats);
+
+//-------------------------------------------------------------------------
+
+#endif
@@ -19,10 +19,16 @@
 #include <Python.h>
 #include "structmember.h"
 #include <ctype.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "element_change.h"
 #include "imageLayer.h"
+#include "pool.h"
+#include "spriteLayer.h"
 
 #include "bcm_host.h"
 
@@ -119,165 +125,2536 @@ static pixelAspectRatio getPixelAspect(TV_DISPLAY_STATE_T *tvstate){
     }
 }
 
+// Display objects are shared, one per display id, and live as long as the module. The dispmanx
+// handle is open while layers use it and the mode is cached until tvservice reports a change.
+typedef struct {
+    PyObject_HEAD
+    uint8_t displayId;
+    DISPMANX_DISPLAY_HANDLE_T handle;
+    int32_t handleUsers;
+    bool cached;
+    uint32_t generation;
+    DISPMANX_MODEINFO_T info;
+    TV_DISPLAY_STATE_T tvstate;
+    bool ntsc;
+} dispmanxDisplay;
+
+static PyTypeObject dispmanxDisplayType;
+
+static dispmanxDisplay *displays[TV_MAX_ATTACHED_DISPLAYS];
+
+// guards the handles and caches below, which are used without the GIL
+static pthread_mutex_t displayLock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_uint displayGeneration;
+static bool displayCallback = false;
+static bool devicesCached = false;
+static uint32_t devicesGeneration;
+static TV_ATTACHED_DEVICES_T devicesCache;
+
+// tvservice calls this on its own thread after hotplug and mode changes
+static void displayChanged (void *data, uint32_t reason, uint32_t param1, uint32_t param2) {
+    atomic_fetch_add (&displayGeneration, 1);
+}
+
+// list the attached displays, cached until tvservice reports a change, called without the GIL
+static bool attachedDisplays (TV_ATTACHED_DEVICES_T *devices) {
+    bool found = true;
+    pthread_mutex_lock (&displayLock);
+    if (!displayCallback) {
+        bcm_host_init();
+        vc_tv_register_callback (displayChanged, NULL);
+        displayCallback = true;
+    }
+    uint32_t generation = atomic_load (&displayGeneration);
+    if (!devicesCached || devicesGeneration != generation) {
+        devicesCached = vc_tv_get_attached_devices (&devicesCache) != -1;
+        devicesGeneration = generation;
+    }
+    if (devicesCached) {
+        *devices = devicesCache;
+    } else {
+        found = false;
+    }
+    pthread_mutex_unlock (&displayLock);
+    return found;
+}
+
+// check a display id is attached, called without the GIL
+static bool displayAttached (uint8_t displayId) {
+    TV_ATTACHED_DEVICES_T devices;
+    if (!attachedDisplays (&devices)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < devices.num_attached; i++) {
+        if (devices.display_number[i] == displayId) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// read the mode of a display, refreshing the cache first if it is stale, called without the GIL
+static bool readDisplay (dispmanxDisplay *display, DISPMANX_MODEINFO_T *info, TV_DISPLAY_STATE_T *tvstate, bool *ntsc) {
+    bool valid = true;
+    pthread_mutex_lock (&displayLock);
+    uint32_t generation = atomic_load (&displayGeneration);
+    if (!display->cached || display->generation != generation) {
+        DISPMANX_DISPLAY_HANDLE_T handle = display->handle;
+        if (handle == DISPMANX_NO_HANDLE) {
+            handle = vc_dispmanx_display_open (display->displayId);
+        }
+        if (handle == DISPMANX_NO_HANDLE) {
+            valid = false;
+        } else {
+            vc_dispmanx_display_get_info (handle, &display->info);
+            vc_tv_get_display_state_id (display->displayId, &display->tvstate);
+            HDMI_PROPERTY_PARAM_T property = {HDMI_PROPERTY_PIXEL_CLOCK_TYPE, 0, 0};
+            vc_tv_hdmi_get_property_id (display->displayId, &property);
+            display->ntsc = property.param1 == HDMI_PIXEL_CLOCK_TYPE_NTSC;
+            display->cached = true;
+            display->generation = generation;
+            if (handle != display->handle) {
+                vc_dispmanx_display_close (handle);
+            }
+        }
+    }
+    if (valid) {
+        if (info != NULL) {
+            *info = display->info;
+        }
+        if (tvstate != NULL) {
+            *tvstate = display->tvstate;
+        }
+        if (ntsc != NULL) {
+            *ntsc = display->ntsc;
+        }
+    }
+    pthread_mutex_unlock (&displayLock);
+    return valid;
+}
+
+// open the display handle for one more user, called without the GIL
+static DISPMANX_DISPLAY_HANDLE_T holdDisplay (dispmanxDisplay *display) {
+    pthread_mutex_lock (&displayLock);
+    if (display->handleUsers == 0) {
+        display->handle = vc_dispmanx_display_open (display->displayId);
+    }
+    if (display->handle != DISPMANX_NO_HANDLE) {
+        display->handleUsers++;
+    }
+    DISPMANX_DISPLAY_HANDLE_T handle = display->handle;
+    pthread_mutex_unlock (&displayLock);
+    return handle;
+}
+
+// close the display handle once its last user is done, called without the GIL
+static void releaseDisplay (dispmanxDisplay *display) {
+    pthread_mutex_lock (&displayLock);
+    if (--display->handleUsers == 0) {
+        vc_dispmanx_display_close (display->handle);
+        display->handle = DISPMANX_NO_HANDLE;
+    }
+    pthread_mutex_unlock (&displayLock);
+}
+
+// the shared object for a display id as a new reference, with the GIL held
+static dispmanxDisplay *getDisplay (int displayId) {
+    if (displayId < 0 || displayId >= TV_MAX_ATTACHED_DISPLAYS) {
+        PyErr_SetString(PyExc_ValueError, "Display ID invalid");
+        return NULL;
+    }
+    if (displays[displayId] == NULL) {
+        dispmanxDisplay *display = PyObject_New (dispmanxDisplay, &dispmanxDisplayType);
+        if (display == NULL) {
+            return NULL;
+        }
+        display->displayId = displayId;
+        display->handle = DISPMANX_NO_HANDLE;
+        display->handleUsers = 0;
+        display->cached = false;
+        // the table keeps this first reference for the life of the module
+        displays[displayId] = display;
+    }
+    Py_INCREF (displays[displayId]);
+    return displays[displayId];
+}
+
+// frame rate of the current mode, NTSC clocks run 1000/1001 slower
+static float frameRateOf (TV_DISPLAY_STATE_T *tvstate, bool ntsc) {
+    if (ntsc) {
+        return tvstate->display.hdmi.frame_rate * (1000.0f/1001.0f);
+    }
+    return tvstate->display.hdmi.frame_rate;
+}
+
+// check a transform is one of the rotations, optionally or'd with the flips
+static bool checkTransform (long transform) {
+    if ((transform & ~(3L | DISPMANX_FLIP_HRIZ | DISPMANX_FLIP_VERT)) != 0) {
+        PyErr_SetString (PyExc_ValueError, "transform must be a ROTATE_* constant or'd with FLIP_HORIZONTAL and FLIP_VERTICAL");
+        return false;
+    }
+    return true;
+}
+
 // Python layer object struct
 typedef struct {
     PyObject_HEAD
     int8_t displayId;
     int32_t number;
+    int32_t buffers;
+    IMAGE_TYPE_INFO_T format;
+    Py_ssize_t bufferShape[3];
+    Py_ssize_t bufferStrides[3];
+    Py_ssize_t exports;
+    bool created;
+    PyThread_type_lock lock;
     IMAGE_LAYER_T imageLayer;
+    dispmanxDisplay *displayObj;
     DISPMANX_DISPLAY_HANDLE_T display;
+    PyObject *vsyncCallback;
+    PyObject *nextVsync;
+    PyObject *nextLayer;
 } dispmanxLayer;
 
+// every created layer for the module wide stats, linked through nextLayer with the GIL held,
+// and the totals of layers that have been deleted
+static PyObject *liveLayers = NULL;
+static IMAGE_LAYER_STATS_T retiredStats;
+
+// find the default display, called without the GIL
+static bool defaultDisplay (uint8_t *displayId) {
+    TV_ATTACHED_DEVICES_T devices;
+    if (attachedDisplays (&devices) && devices.num_attached > 0) {
+        *displayId = devices.display_number[0];
+        return true;
+    }
+    return false;
+}
+
+// take the layer lock, dropping the GIL while waiting for another thread to finish with the layer
+static void lockLayer (dispmanxLayer *self) {
+    if (!PyThread_acquire_lock (self->lock, NOWAIT_LOCK)) {
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock (self->lock, WAIT_LOCK);
+        Py_END_ALLOW_THREADS
+    }
+}
+
+// vsync source shared by waitVsync, the layer callbacks and vsyncEvents, the firmware only keeps one vsync
+// callback per process. It is registered while it has users and can follow another display once it has none,
+// vsyncSourceLock guards the handle and the users, vsyncLock the count the callback updates
+static pthread_mutex_t vsyncSourceLock = PTHREAD_MUTEX_INITIALIZER;
+static DISPMANX_DISPLAY_HANDLE_T vsyncDisplay = DISPMANX_NO_HANDLE;
+static int vsyncDisplayId = -1;
+static int vsyncUsers = 0;
+static pthread_mutex_t vsyncLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vsyncSignal = PTHREAD_COND_INITIALIZER;
+static uint64_t vsyncCount = 0;
+static double vsyncTime = 0;
+
+// layers with a vsync callback, linked through nextVsync and only touched with the GIL held
+static PyObject *vsyncLayers = NULL;
+static bool vsyncDispatching = false;
+
+enum { VSYNC_OK, VSYNC_OPEN_FAILED, VSYNC_OTHER_DISPLAY };
+
+// asyncio support, update completions and vsyncs are signalled through an eventfd the event loop reads
+// whenever asyncPending says there is an awaited update or vsync
+static atomic_int asyncFd = -1;
+static atomic_int asyncPending = 0;
+
+// called on the dispmanx thread after an update completes or a vsync arrives
+static void asyncNotify (void *arg) {
+    int fd = atomic_load (&asyncFd);
+    if (fd >= 0 && atomic_load (&asyncPending) > 0) {
+        uint64_t one = 1;
+        ssize_t written = write (fd, &one, sizeof (one));
+        (void) written;
+    }
+}
+
+// called by dispmanx on its own thread at every vsync
+static void vsyncCallback (DISPMANX_UPDATE_HANDLE_T update, void *arg) {
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock (&vsyncLock);
+    vsyncCount++;
+    vsyncTime = now.tv_sec + now.tv_nsec / 1e9;
+    pthread_cond_broadcast (&vsyncSignal);
+    pthread_mutex_unlock (&vsyncLock);
+    asyncNotify (NULL);
+}
+
+// count vsyncs on a display for one more user, registering the callback for the first, called without the GIL
+static int holdVsync (uint8_t displayId) {
+    int status = VSYNC_OK;
+    pthread_mutex_lock (&vsyncSourceLock);
+    if (vsyncUsers > 0 && vsyncDisplayId != displayId) {
+        status = VSYNC_OTHER_DISPLAY;
+    } else if (vsyncUsers == 0) {
+        vsyncDisplay = vc_dispmanx_display_open (displayId);
+        if (vsyncDisplay == DISPMANX_NO_HANDLE) {
+            status = VSYNC_OPEN_FAILED;
+        } else {
+            vc_dispmanx_vsync_callback (vsyncDisplay, vsyncCallback, NULL);
+            vsyncDisplayId = displayId;
+        }
+    }
+    if (status == VSYNC_OK) {
+        vsyncUsers++;
+    }
+    pthread_mutex_unlock (&vsyncSourceLock);
+    return status;
+}
+
+// drop a user of the vsync source, the last one unregisters the callback and closes the display,
+// called without the GIL
+static void releaseVsync (void) {
+    pthread_mutex_lock (&vsyncSourceLock);
+    if (--vsyncUsers == 0) {
+        vc_dispmanx_vsync_callback (vsyncDisplay, NULL, NULL);
+        vc_dispmanx_display_close (vsyncDisplay);
+        vsyncDisplay = DISPMANX_NO_HANDLE;
+        vsyncDisplayId = -1;
+    }
+    pthread_mutex_unlock (&vsyncSourceLock);
+}
+
+static bool checkVsync (int status) {
+    switch (status) {
+        case VSYNC_OPEN_FAILED:
+            PyErr_SetString (PyExc_RuntimeError, "Unable to open display");
+            return false;
+        case VSYNC_OTHER_DISPLAY:
+            PyErr_SetString (PyExc_ValueError, "vsync is already being followed on another display");
+            return false;
+    }
+    return true;
+}
+
+// read the latest vsync count and time
+static void lastVsync (uint64_t *count, double *time) {
+    pthread_mutex_lock (&vsyncLock);
+    *count = vsyncCount;
+    *time = vsyncTime;
+    pthread_mutex_unlock (&vsyncLock);
+}
+
+// wait up to timeout seconds for a vsync after the one counted as after, called without the GIL
+static bool nextVsync (uint64_t after, double timeout, uint64_t *count, double *time) {
+    struct timespec deadline;
+    clock_gettime (CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t) timeout;
+    deadline.tv_nsec += (long) ((timeout - (time_t) timeout) * 1e9);
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock (&vsyncLock);
+    while (vsyncCount == after) {
+        if (pthread_cond_timedwait (&vsyncSignal, &vsyncLock, &deadline) != 0) {
+            break;
+        }
+    }
+    *count = vsyncCount;
+    *time = vsyncTime;
+    pthread_mutex_unlock (&vsyncLock);
+    return *count != after;
+}
+
+// thread that runs the layer callbacks, vsyncs missed while they run are folded into the next call
+static void vsyncDispatch (void *arg) {
+    PyGILState_STATE gil = PyGILState_Ensure ();
+    uint64_t seen, count;
+    double time;
+    lastVsync (&seen, &time);
+    while (vsyncLayers != NULL) {
+        bool arrived;
+        // wake up regularly so the thread ends soon after the last callback is removed
+        Py_BEGIN_ALLOW_THREADS
+        arrived = nextVsync (seen, 0.1, &count, &time);
+        Py_END_ALLOW_THREADS
+        if (!arrived) {
+            continue;
+        }
+        seen = count;
+        // hold the callbacks while calling them, they can clear callbacks or delete layers
+        PyObject *callbacks = PyList_New (0);
+        if (callbacks == NULL) {
+            PyErr_WriteUnraisable (NULL);
+            continue;
+        }
+        for (PyObject *layer = vsyncLayers; layer != NULL; layer = ((dispmanxLayer *) layer)->nextVsync) {
+            PyList_Append (callbacks, ((dispmanxLayer *) layer)->vsyncCallback);
+        }
+        for (Py_ssize_t i = 0; i < PyList_GET_SIZE (callbacks); i++) {
+            PyObject *callback = PyList_GET_ITEM (callbacks, i);
+            PyObject *result = PyObject_CallFunction (callback, "Kd", (unsigned long long) count, time);
+            if (result == NULL) {
+                PyErr_WriteUnraisable (callback);
+            }
+            Py_XDECREF (result);
+        }
+        Py_DECREF (callbacks);
+    }
+    vsyncDispatching = false;
+    PyGILState_Release (gil);
+}
+
+// take a layer out of the vsync callback list, with the GIL held
+static void removeVsync (dispmanxLayer *self) {
+    PyObject **link = &vsyncLayers;
+    while (*link != NULL) {
+        if (*link == (PyObject *) self) {
+            *link = self->nextVsync;
+            break;
+        }
+        link = & ((dispmanxLayer *) *link)->nextVsync;
+    }
+    self->nextVsync = NULL;
+    if (self->vsyncCallback != NULL) {
+        Py_CLEAR (self->vsyncCallback);
+        Py_BEGIN_ALLOW_THREADS
+        releaseVsync ();
+        Py_END_ALLOW_THREADS
+    }
+}
+
+// an awaited layer update, its futures are resolved once the update is on screen
+typedef struct asyncUpdate {
+    dispmanxLayer *layer;
+    PyObject *futures;
+    bool sent;
+    uint64_t update;
+    struct asyncUpdate *next;
+} asyncUpdate;
+
+// awaited updates in the order they were asked for, and [iterator, future] pairs waiting for a vsync,
+// only touched with the GIL held
+static asyncUpdate *asyncUpdates = NULL;
+static PyObject *vsyncWaiters = NULL;
+
+// the loop the eventfd reader is registered with
+static PyObject *asyncLoop = NULL;
+
+// iterator returned by vsyncEvents, seen is the last vsync it returned
+typedef struct {
+    PyObject_HEAD
+    uint64_t seen;
+} dispmanxVsyncEvents;
+
+// true once a future has a result or was cancelled, with the GIL held
+static bool futureDone (PyObject *future) {
+    PyObject *done = PyObject_CallMethod (future, "done", NULL);
+    if (done == NULL) {
+        PyErr_WriteUnraisable (future);
+        return true;
+    }
+    bool isDone = PyObject_IsTrue (done);
+    Py_DECREF (done);
+    return isDone;
+}
+
+// resolve a future unless it was cancelled, with the GIL held
+static void resolveFuture (PyObject *future, PyObject *result) {
+    if (!futureDone (future)) {
+        PyObject *set = PyObject_CallMethod (future, "set_result", "(O)", result);
+        if (set == NULL) {
+            PyErr_WriteUnraisable (future);
+        }
+        Py_XDECREF (set);
+    }
+}
+
+// drop futures that were cancelled while they waited, true if any are left
+static bool liveFutures (PyObject *futures) {
+    for (Py_ssize_t i = PyList_GET_SIZE (futures) - 1; i >= 0; i--) {
+        if (futureDone (PyList_GET_ITEM (futures, i))) {
+            PySequence_DelItem (futures, i);
+        }
+    }
+    return PyList_GET_SIZE (futures) > 0;
+}
+
+// write and submit an awaited update once the layer has a free resource, without waiting for the display
+// if change detection finds nothing new it waits for the last update instead
+static void submitAsync (asyncUpdate *pending) {
+    dispmanxLayer *self = pending->layer;
+    lockLayer (self);
+    Py_BEGIN_ALLOW_THREADS
+    if (findChangesImageLayer (& (self->imageLayer))) {
+        DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start (0);
+        changeSourceImageLayer (& (self->imageLayer), update);
+        submitUpdateImageLayer (& (self->imageLayer), update, false);
+    } else {
+        skipUpdateImageLayer (& (self->imageLayer));
+    }
+    pending->update = self->imageLayer.updatesSubmitted;
+    pending->sent = true;
+    Py_END_ALLOW_THREADS
+    PyThread_release_lock (self->lock);
+}
+
+// move every awaited update and vsync on as far as it can go without blocking, with the GIL held
+static void pumpAsync (void) {
+    // keep the dispmanx thread signalling while updates are submitted below
+    atomic_fetch_add (&asyncPending, 1);
+    int pending = 0;
+    asyncUpdate **link = &asyncUpdates;
+    while (*link != NULL) {
+        asyncUpdate *item = *link;
+        IMAGE_LAYER_T *il = & (item->layer->imageLayer);
+        bool live = liveFutures (item->futures);
+        // once nobody waits for it an update that was not sent yet is left to the next one
+        if (!item->sent && live && readyForUpdateImageLayer (il)) {
+            submitAsync (item);
+        }
+        bool finished = !live;
+        if (live && item->sent && updatesDoneImageLayer (il) >= item->update) {
+            for (Py_ssize_t i = 0; i < PyList_GET_SIZE (item->futures); i++) {
+                resolveFuture (PyList_GET_ITEM (item->futures, i), Py_None);
+            }
+            finished = true;
+        }
+        if (finished) {
+            *link = item->next;
+            Py_DECREF (item->layer);
+            Py_DECREF (item->futures);
+            PyMem_Free (item);
+        } else {
+            link = &item->next;
+            pending++;
+        }
+    }
+
+    if (vsyncWaiters != NULL && PyList_GET_SIZE (vsyncWaiters) > 0) {
+        uint64_t count;
+        double time;
+        lastVsync (&count, &time);
+        for (Py_ssize_t i = PyList_GET_SIZE (vsyncWaiters) - 1; i >= 0; i--) {
+            PyObject *waiter = PyList_GET_ITEM (vsyncWaiters, i);
+            dispmanxVsyncEvents *events = (dispmanxVsyncEvents *) PyList_GET_ITEM (waiter, 0);
+            if (count > events->seen) {
+                PyObject *result = Py_BuildValue ("(Kd)", (unsigned long long) count, time);
+                if (result != NULL) {
+                    resolveFuture (PyList_GET_ITEM (waiter, 1), result);
+                    Py_DECREF (result);
+                } else {
+                    PyErr_WriteUnraisable (NULL);
+                }
+                events->seen = count;
+                PySequence_DelItem (vsyncWaiters, i);
+            } else if (futureDone (PyList_GET_ITEM (waiter, 1))) {
+                PySequence_DelItem (vsyncWaiters, i);
+            }
+        }
+        pending += PyList_GET_SIZE (vsyncWaiters);
+    }
+    atomic_store (&asyncPending, pending);
+}
+
+// event loop reader for the eventfd
+static PyObject *asyncReady (PyObject *self, PyObject *args) {
+    uint64_t count;
+    ssize_t got = read (atomic_load (&asyncFd), &count, sizeof (count));
+    (void) got;
+    pumpAsync ();
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef asyncReadyDef = {"asyncReady", (PyCFunction) asyncReady, METH_NOARGS, NULL};
+
+// make a future on the running loop, registering the eventfd with the loop the first time it is seen
+static PyObject *asyncFuture (void) {
+    if (atomic_load (&asyncFd) < 0) {
+        int fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) {
+            return PyErr_SetFromErrno (PyExc_OSError);
+        }
+        atomic_store (&asyncFd, fd);
+    }
+    PyObject *asyncio = PyImport_ImportModule ("asyncio");
+    if (asyncio == NULL) {
+        return NULL;
+    }
+    PyObject *loop = PyObject_CallMethod (asyncio, "get_running_loop", NULL);
+    Py_DECREF (asyncio);
+    if (loop == NULL) {
+        return NULL;
+    }
+    if (loop != asyncLoop) {
+        // a loop from an earlier asyncio.run may already be closed, it no longer matters if this fails
+        if (asyncLoop != NULL) {
+            PyObject *removed = PyObject_CallMethod (asyncLoop, "remove_reader", "i", atomic_load (&asyncFd));
+            Py_XDECREF (removed);
+            PyErr_Clear ();
+        }
+        PyObject *reader = PyCFunction_New (&asyncReadyDef, NULL);
+        PyObject *added = reader == NULL ? NULL : PyObject_CallMethod (loop, "add_reader", "iO", atomic_load (&asyncFd), reader);
+        Py_XDECREF (reader);
+        if (added == NULL) {
+            Py_DECREF (loop);
+            return NULL;
+        }
+        Py_DECREF (added);
+        Py_XSETREF (asyncLoop, loop);
+        Py_INCREF (loop);
+    }
+    PyObject *future = PyObject_CallMethod (loop, "create_future", NULL);
+    Py_DECREF (loop);
+    return future;
+}
+
 // setup the display when the object is created
 static PyObject *dispmanxLayer_new (PyTypeObject *type, PyObject *args, PyObject *kwds)  {
     dispmanxLayer *self;
     self = (dispmanxLayer *) type->tp_alloc (type,0);
 
-    bcm_host_init();
-    if (self != NULL) {
-        self->displayId = DEFAULT_DISPLAY;
-        TV_ATTACHED_DEVICES_T devices;
-        if (vc_tv_get_attached_devices(&devices) != -1 && devices.num_attached > 0) {
-            self->displayId = devices.display_number[0];
-        }
-        self->number = 1;
+    if (self != NULL) {
+        uint8_t displayId = DEFAULT_DISPLAY;
+        Py_BEGIN_ALLOW_THREADS
+        defaultDisplay (&displayId);
+        Py_END_ALLOW_THREADS
+        self->displayId = displayId;
+        self->number = 1;
+        self->buffers = 2;
+        findImageType (&self->format, "RGBA32", IMAGE_TYPES_ALL);
+        self->created = false;
+        self->lock = PyThread_allocate_lock ();
+        if (self->lock == NULL) {
+            Py_DECREF (self);
+            return PyErr_NoMemory ();
+        }
+    }
+    return (PyObject *) self;
+}
+
+// create a fullscreen transparent layer when a new object is created
+static int dispmanxLayer_init (dispmanxLayer *self, PyObject *args, PyObject *kwds)  {
+    static char *kwlist[] = {"layer", "display", "buffers", "upload", "format", "size", "dest", "pipeline", "detectChanges", "shared", "transform", NULL};
+    const char *uploadName = NULL;
+    const char *formatName = NULL;
+    PyObject *sizeArg = NULL;
+    PyObject *destArg = NULL;
+    PyObject *displayArg = NULL;
+    int pipeline = 0;
+    int detectChanges = 0;
+    int shared = 0;
+    int transform = DISPMANX_NO_ROTATE;
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "i|OizzOOpppi", kwlist, &self->number, &displayArg, &self->buffers, &uploadName, &formatName, &sizeArg, &destArg, &pipeline, &detectChanges, &shared, &transform)) {
+        return -1;
+    }
+    if (!checkTransform (transform)) {
+        return -1;
+    }
+    // the display is either an id or a shared Display object
+    int displayId = self->displayId;
+    if (displayArg != NULL && PyObject_TypeCheck (displayArg, &dispmanxDisplayType)) {
+        displayId = ((dispmanxDisplay *) displayArg)->displayId;
+    } else if (displayArg != NULL) {
+        displayId = PyLong_AsLong (displayArg);
+        if (displayId == -1 && PyErr_Occurred ()) {
+            return -1;
+        }
+    }
+    // windowed layers, the buffer is size and the HVS scales it into dest
+    int32_t width = 0, height = 0;
+    VC_RECT_T dest = {0, 0, 0, 0};
+    bool hasSize = sizeArg != NULL && sizeArg != Py_None;
+    bool hasDest = destArg != NULL && destArg != Py_None;
+    if (hasSize) {
+        if (!PyArg_Parse (sizeArg, "(ii)", &width, &height)) {
+            return -1;
+        }
+        if (width <= 0 || height <= 0) {
+            PyErr_SetString(PyExc_ValueError, "size must be positive");
+            return -1;
+        }
+    }
+    if (hasDest) {
+        if (!PyArg_Parse (destArg, "(iiii)", &dest.x, &dest.y, &dest.width, &dest.height)) {
+            return -1;
+        }
+        if (dest.width <= 0 || dest.height <= 0) {
+            PyErr_SetString(PyExc_ValueError, "dest width and height must be positive");
+            return -1;
+        }
+    }
+    if (formatName != NULL && !findImageType (&self->format, formatName, IMAGE_TYPES_ALL)) {
+        PyErr_Format(PyExc_ValueError, "unknown format %s", formatName);
+        return -1;
+    }
+    if (self->buffers < 1 || self->buffers > IMAGE_LAYER_MAX_RESOURCES) {
+        PyErr_Format(PyExc_ValueError, "buffers must be between 1 and %d", IMAGE_LAYER_MAX_RESOURCES);
+        return -1;
+    }
+    // the buffer stays RGBA32, the resources hold the converted rows
+    IMAGE_TYPE_INFO_T upload = {0};
+    if (uploadName != NULL &&
+        (!findImageType (&upload, uploadName, IMAGE_TYPES_ALL_DIRECT_COLOUR) ||
+         (upload.type != VC_IMAGE_RGB565 && upload.type != VC_IMAGE_RGBA16))) {
+        PyErr_SetString(PyExc_ValueError, "upload must be RGB565 or RGBA16");
+        return -1;
+    }
+    if (uploadName != NULL && self->format.type != VC_IMAGE_RGBA32) {
+        PyErr_SetString(PyExc_ValueError, "upload can only be used with RGBA32 layers");
+        return -1;
+    }
+    // the GPU copies from the shared buffer itself, so there must be no copy in between
+    if (shared && (uploadName != NULL || pipeline)) {
+        PyErr_SetString(PyExc_ValueError, "shared can't be combined with upload or pipeline");
+        return -1;
+    }
+    if (self->created) {
+        PyErr_SetString(PyExc_RuntimeError, "Layer already created");
+        return -1;
+    }
+
+    dispmanxDisplay *display = getDisplay (displayId);
+    if (display == NULL) {
+        return -1;
+    }
+    self->displayId = displayId;
+
+    enum { LAYER_OK, LAYER_NO_DEVICES, LAYER_NO_DISPLAY, LAYER_BAD_DISPLAY, LAYER_OPEN_FAILED, LAYER_NO_PIPELINE, LAYER_NO_MEMORY, LAYER_NO_SHARED } status = LAYER_OK;
+
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock (self->lock, WAIT_LOCK);
+    TV_ATTACHED_DEVICES_T devices;
+    if (!attachedDisplays (&devices)) {
+        status = LAYER_NO_DEVICES;
+    } else if (devices.num_attached<1) {
+        status = LAYER_NO_DISPLAY;
+    } else {
+        bool found = false;
+        for(uint32_t i = 0; i < devices.num_attached; i++) {
+            if(devices.display_number[i] == self->displayId) {
+                 found = true;
+            }
+        }
+        if(!found){
+            status = LAYER_BAD_DISPLAY;
+        }
+    }
+
+    DISPMANX_MODEINFO_T info;
+    TV_DISPLAY_STATE_T tvstate;
+    if (status == LAYER_OK) {
+        self->display = holdDisplay (display);
+        if (self->display == DISPMANX_NO_HANDLE) {
+            status = LAYER_OPEN_FAILED;
+        } else if (!readDisplay (display, &info, &tvstate, NULL)) {
+            releaseDisplay (display);
+            status = LAYER_OPEN_FAILED;
+        }
+    }
+
+    if (status == LAYER_OK) {
+        pixelAspectRatio par = getPixelAspect(&tvstate);
+        // a quarter turn shows the buffer columns as screen rows, so default sizes swap
+        bool swapped = (transform & DISPMANX_ROTATE_90) != 0;
+        if (!hasSize && hasDest) {
+            width = swapped ? dest.height : dest.width;
+            height = swapped ? dest.width : dest.height;
+        } else if (!hasSize) {
+            width = swapped ? info.height : par.displayWidth;
+            height = swapped ? par.displayWidth : info.height;
+        }
+        // without a destination a sized buffer is shown unscaled at the top left, the default fills the screen
+        if (!hasDest && hasSize) {
+            vc_dispmanx_rect_set (&dest, 0, 0, swapped ? height : width, swapped ? width : height);
+        } else if (!hasDest) {
+            vc_dispmanx_rect_set (&dest, 0, 0, info.width, info.height);
+        }
+        if (!initImagePool (& (self->imageLayer.image), self->format.type, width, height, true)) {
+            releaseDisplay (display);
+            status = LAYER_NO_MEMORY;
+        }
+    }
+
+    if (status == LAYER_OK) {
+        // nothing is on the screen until the element is added, so these can still fail cleanly
+        if (uploadName != NULL && !convertImageLayer (& (self->imageLayer), upload.type)) {
+            status = LAYER_NO_MEMORY;
+        } else if (shared && !shareImageLayer (& (self->imageLayer))) {
+            status = LAYER_NO_SHARED;
+        } else if (detectChanges && !detectChangesImageLayer (& (self->imageLayer), true)) {
+            status = LAYER_NO_MEMORY;
+        }
+        if (status != LAYER_OK) {
+            destroyImagesImageLayer (& (self->imageLayer));
+            releaseDisplay (display);
+        }
+    }
+
+    if (status == LAYER_OK) {
+        createResourcesImageLayer (& (self->imageLayer), self->number, self->buffers);
+        self->imageLayer.transform = transform;
+        self->imageLayer.notify = asyncNotify;
+        DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start (0);
+        addElementImageLayerDest (& (self->imageLayer), &dest, self->display, update);
+        vc_dispmanx_update_submit_sync (update);
+        self->created = true;
+        if (pipeline && !startPipelineImageLayer (& (self->imageLayer))) {
+            status = LAYER_NO_PIPELINE;
+        }
+    }
+    PyThread_release_lock (self->lock);
+    Py_END_ALLOW_THREADS
+
+    switch (status) {
+        case LAYER_NO_PIPELINE:
+            // the layer itself was made, dealloc removes it from the display again
+            self->displayObj = display;
+            PyErr_SetString(PyExc_RuntimeError, "Unable to start the upload thread");
+            return -1;
+        case LAYER_OK:
+            self->displayObj = display;
+            self->nextLayer = liveLayers;
+            liveLayers = (PyObject *) self;
+            return 0;
+        case LAYER_NO_DEVICES:
+            PyErr_SetString(PyExc_RuntimeError, "Unable to list displays");
+            break;
+        case LAYER_NO_DISPLAY:
+            PyErr_SetString(PyExc_RuntimeError, "No display connected");
+            break;
+        case LAYER_BAD_DISPLAY:
+            PyErr_SetString(PyExc_ValueError, "Display ID invalid");
+            break;
+        case LAYER_OPEN_FAILED:
+            PyErr_SetString(PyExc_RuntimeError, "Unable to open display");
+            break;
+        case LAYER_NO_MEMORY:
+            PyErr_NoMemory ();
+            break;
+        case LAYER_NO_SHARED:
+            PyErr_SetString(PyExc_RuntimeError, "Unable to allocate VideoCore shared memory");
+            break;
+    }
+    Py_DECREF (display);
+    return -1;
+}
+
+
+// when the object is deleted delete both the layer and the display
+static void dispmanxLayer_dealloc (dispmanxLayer *self) {
+    removeVsync (self);
+    for (PyObject **link = &liveLayers; *link != NULL; link = & ((dispmanxLayer *) *link)->nextLayer) {
+        if (*link == (PyObject *) self) {
+            *link = self->nextLayer;
+            break;
+        }
+    }
+    if (self->created) {
+        IMAGE_LAYER_STATS_T stats;
+        getStatsImageLayer (& (self->imageLayer), &stats);
+        addStatsImageLayer (&retiredStats, &stats);
+        Py_BEGIN_ALLOW_THREADS
+        destroyImageLayer (& (self->imageLayer));
+        releaseDisplay (self->displayObj);
+        Py_END_ALLOW_THREADS
+    }
+    Py_CLEAR (self->displayObj);
+    if (self->lock != NULL) {
+        PyThread_free_lock (self->lock);
+    }
+    Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+// raise an error for methods used on a layer whose init failed or was never called
+static bool checkCreated (dispmanxLayer *self) {
+    if (!self->created) {
+        PyErr_SetString(PyExc_RuntimeError, "Layer not created");
+        return false;
+    }
+    return true;
+}
+
+// convert a python (x, y, width, height) sequence to a rect
+static bool parseRect (PyObject *obj, VC_RECT_T *rect) {
+    int32_t x, y, width, height;
+    if (!PyArg_Parse (obj, "(iiii)", &x, &y, &width, &height)) {
+        return false;
+    }
+    vc_dispmanx_rect_set (rect, x, y, width, height);
+    return true;
+}
+
+// function to add a rectangle to the region uploaded by the next update
+static PyObject *method_markDirty (dispmanxLayer *self, PyObject *args) {
+    PyObject *rectArg;
+    VC_RECT_T rect;
+    if (!PyArg_ParseTuple (args, "O", &rectArg) || !parseRect (rectArg, &rect) || !checkCreated (self)) {
+        return NULL;
+    }
+    lockLayer (self);
+    bool marked = markDirtyImageLayer (& (self->imageLayer), &rect);
+    PyThread_release_lock (self->lock);
+    if (marked) {
+        Py_RETURN_TRUE;
+    }
+    Py_RETURN_FALSE;
+}
+
+// function to trigger an update to the display, optionally only uploading the rows covered by the given rectangles
+// with block=False it returns as soon as the buffer is uploaded and the update is queued for the next vsync,
+// pipelined layers only copy the changed rows for their upload thread and never wait
+static PyObject *method_updateLayer (dispmanxLayer *self, PyObject *args, PyObject *kwds) {
+    int block = 1;
+    if (kwds != NULL) {
+        static char *kwlist[] = {"block", NULL};
+        PyObject *noArgs = PyTuple_New (0);
+        int parsed = PyArg_ParseTupleAndKeywords (noArgs, kwds, "|p", kwlist, &block);
+        Py_DECREF (noArgs);
+        if (!parsed) {
+            return NULL;
+        }
+    }
+    if (!checkCreated (self)) {
+        return NULL;
+    }
+    Py_ssize_t rects = PyTuple_GET_SIZE (args);
+    VC_RECT_T *rect = PyMem_New (VC_RECT_T, rects);
+    if (rect == NULL && rects > 0) {
+        return PyErr_NoMemory ();
+    }
+    for (Py_ssize_t i = 0; i < rects; i++) {
+        if (!parseRect (PyTuple_GET_ITEM (args, i), &rect[i])) {
+            PyMem_Free (rect);
+            return NULL;
+        }
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock (self->lock, WAIT_LOCK);
+    for (Py_ssize_t i = 0; i < rects; i++) {
+        markDirtyImageLayer (& (self->imageLayer), &rect[i]);
+    }
+    IMAGE_LAYER_PIPELINE_T *pipeline = self->imageLayer.pipeline;
+    int32_t dirtyBands = pipeline != NULL ? pipeline->dirtyBands : self->imageLayer.dirtyBands;
+    // every rectangle given was off screen so there is nothing to show
+    if (rects > 0 && dirtyBands == 0) {
+        skipUpdateImageLayer (& (self->imageLayer));
+    } else if (pipeline != NULL) {
+        // the upload thread does the rest, so there is never anything to wait for
+        publishImageLayer (& (self->imageLayer));
+        block = 0;
+    } else if (!findChangesImageLayer (& (self->imageLayer))) {
+        skipUpdateImageLayer (& (self->imageLayer));
+    } else {
+        DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start (0);
+        changeSourceImageLayer (& (self->imageLayer), update);
+        submitUpdateImageLayer (& (self->imageLayer), update, false);
+    }
+    PyThread_release_lock (self->lock);
+    // wait for the display outside the layer lock so other threads can queue the next frame
+    if (block) {
+        waitForUpdatesImageLayer (& (self->imageLayer), 0);
+    }
+    Py_END_ALLOW_THREADS
+
+    PyMem_Free (rect);
+    Py_RETURN_TRUE;
+}
+
+// function returning a future that is done once the buffer is on screen, for use with asyncio
+// the upload waits in the event loop for a free resource instead of blocking it
+static PyObject *method_updateAsync (dispmanxLayer *self, PyObject *args) {
+    if (!checkCreated (self)) {
+        return NULL;
+    }
+    Py_ssize_t rects = PyTuple_GET_SIZE (args);
+    VC_RECT_T *rect = PyMem_New (VC_RECT_T, rects);
+    if (rect == NULL && rects > 0) {
+        return PyErr_NoMemory ();
+    }
+    for (Py_ssize_t i = 0; i < rects; i++) {
+        if (!parseRect (PyTuple_GET_ITEM (args, i), &rect[i])) {
+            PyMem_Free (rect);
+            return NULL;
+        }
+    }
+    PyObject *future = asyncFuture ();
+    if (future == NULL) {
+        PyMem_Free (rect);
+        return NULL;
+    }
+
+    lockLayer (self);
+    for (Py_ssize_t i = 0; i < rects; i++) {
+        markDirtyImageLayer (& (self->imageLayer), &rect[i]);
+    }
+    PyMem_Free (rect);
+    IMAGE_LAYER_PIPELINE_T *pipeline = self->imageLayer.pipeline;
+    int32_t dirtyBands = pipeline != NULL ? pipeline->dirtyBands : self->imageLayer.dirtyBands;
+    bool skipped = rects > 0 && dirtyBands == 0;
+    if (skipped) {
+        skipUpdateImageLayer (& (self->imageLayer));
+    } else if (pipeline != NULL) {
+        publishImageLayer (& (self->imageLayer));
+    }
+    PyThread_release_lock (self->lock);
+    // nothing to wait for when nothing was visible or the upload thread has the frame
+    if (skipped || pipeline != NULL) {
+        resolveFuture (future, Py_None);
+        return future;
+    }
+
+    // updates asked for before the last one was sent go out together
+    asyncUpdate **link = &asyncUpdates;
+    while (*link != NULL && ((*link)->layer != self || (*link)->sent)) {
+        link = & (*link)->next;
+    }
+    if (*link == NULL) {
+        asyncUpdate *item = PyMem_Malloc (sizeof (asyncUpdate));
+        if (item == NULL) {
+            Py_DECREF (future);
+            return PyErr_NoMemory ();
+        }
+        item->futures = PyList_New (0);
+        if (item->futures == NULL) {
+            PyMem_Free (item);
+            Py_DECREF (future);
+            return NULL;
+        }
+        Py_INCREF (self);
+        item->layer = self;
+        item->sent = false;
+        item->update = 0;
+        item->next = NULL;
+        *link = item;
+    }
+    if (PyList_Append ((*link)->futures, future) < 0) {
+        Py_DECREF (future);
+        return NULL;
+    }
+    pumpAsync ();
+    return future;
+}
+
+// new element attributes, only the ones selected by the change flags are used
+typedef struct {
+    int32_t x;
+    int32_t y;
+    int32_t layer;
+    uint8_t opacity;
+    DISPMANX_TRANSFORM_T transform;
+} layerAttributes;
+
+// send only element attributes to the display, no pixels are uploaded. The new values are
+// stored and sent under the layer lock so concurrent changes reach the element in the order
+// they were stored, the upload thread only changes the element's source and never reads them
+static void changeAttributes (dispmanxLayer *self, uint32_t changeFlags, const layerAttributes *change, bool block) {
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock (self->lock, WAIT_LOCK);
+    if (changeFlags & ELEMENT_CHANGE_DEST_RECT) {
+        self->imageLayer.dstRect.x = change->x;
+        self->imageLayer.dstRect.y = change->y;
+    }
+    if (changeFlags & ELEMENT_CHANGE_LAYER) {
+        self->imageLayer.layer = change->layer;
+    }
+    if (changeFlags & ELEMENT_CHANGE_OPACITY) {
+        self->imageLayer.opacity = change->opacity;
+    }
+    if (changeFlags & ELEMENT_CHANGE_TRANSFORM) {
+        self->imageLayer.transform = change->transform;
+    }
+    // keep at most one change queued so a tight loop cannot run ahead of the display
+    waitForUpdatesImageLayer (& (self->imageLayer), 1);
+    DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start (0);
+    changeAttributesImageLayer (& (self->imageLayer), changeFlags, update);
+    submitAttributesImageLayer (& (self->imageLayer), update, false);
+    PyThread_release_lock (self->lock);
+    if (block) {
+        waitForUpdatesImageLayer (& (self->imageLayer), 0);
+    }
+    Py_END_ALLOW_THREADS
+}
+
+// function to move the layer on the screen without uploading it again
+static PyObject *method_move (dispmanxLayer *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"x", "y", "block", NULL};
+    int32_t x, y;
+    int block = 0;
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "ii|p", kwlist, &x, &y, &block)) {
+        return NULL;
+    }
+    if (!checkCreated (self)) {
+        return NULL;
+    }
+    layerAttributes change = {.x = x, .y = y};
+    changeAttributes (self, ELEMENT_CHANGE_DEST_RECT, &change, block);
+    Py_RETURN_NONE;
+}
+
+// function to call callback(count, timestamp) on every vsync of the layer's display, None stops it
+static PyObject *method_onVsync (dispmanxLayer *self, PyObject *args) {
+    PyObject *callback;
+    if (!PyArg_ParseTuple (args, "O", &callback)) {
+        return NULL;
+    }
+    if (callback == Py_None) {
+        removeVsync (self);
+        Py_RETURN_NONE;
+    }
+    if (!PyCallable_Check (callback)) {
+        PyErr_SetString (PyExc_TypeError, "callback must be callable or None");
+        return NULL;
+    }
+    if (!checkCreated (self)) {
+        return NULL;
+    }
+    // a layer holds the vsync source while it has a callback
+    if (self->vsyncCallback == NULL) {
+        int status;
+        Py_BEGIN_ALLOW_THREADS
+        status = holdVsync (self->displayId);
+        Py_END_ALLOW_THREADS
+        if (!checkVsync (status)) {
+            return NULL;
+        }
+    }
+    if (!vsyncDispatching) {
+        if (PyThread_start_new_thread (vsyncDispatch, NULL) == PYTHREAD_INVALID_THREAD_ID) {
+            if (self->vsyncCallback == NULL) {
+                Py_BEGIN_ALLOW_THREADS
+                releaseVsync ();
+                Py_END_ALLOW_THREADS
+            }
+            PyErr_SetString (PyExc_RuntimeError, "Unable to start the vsync thread");
+            return NULL;
+        }
+        vsyncDispatching = true;
+    }
+    Py_INCREF (callback);
+    Py_XSETREF (self->vsyncCallback, callback);
+    if (self->nextVsync == NULL && vsyncLayers != (PyObject *) self) {
+        self->nextVsync = vsyncLayers;
+        vsyncLayers = (PyObject *) self;
+    }
+    Py_RETURN_NONE;
+}
+
+// build the dict returned by the stats functions
+static PyObject *statsDict (const IMAGE_LAYER_STATS_T *stats, Py_ssize_t exports) {
+    PyObject *buckets = PyTuple_New (IMAGE_LAYER_LATENCY_BUCKETS);
+    PyObject *latency = PyTuple_New (IMAGE_LAYER_LATENCY_BUCKETS);
+    if (buckets == NULL || latency == NULL) {
+        Py_XDECREF (buckets);
+        Py_XDECREF (latency);
+        return NULL;
+    }
+    for (int i = 0; i < IMAGE_LAYER_LATENCY_BUCKETS; i++) {
+        double bound = i < IMAGE_LAYER_LATENCY_BUCKETS - 1 ? (double) (1 << i) / 1000 : Py_HUGE_VAL;
+        PyTuple_SET_ITEM (buckets, i, PyFloat_FromDouble (bound));
+        PyTuple_SET_ITEM (latency, i, PyLong_FromUnsignedLongLong (stats->latency[i]));
+    }
+    return Py_BuildValue ("{sKsKsdsdsNsNsKsKsKsn}",
+                          "bytesUploaded", (unsigned long long) stats->bytesUploaded,
+                          "writes", (unsigned long long) stats->writes,
+                          "writeTime", stats->writeNs / 1e9,
+                          "maxWriteTime", stats->maxWriteNs / 1e9,
+                          "updateLatency", latency,
+                          "updateLatencyBuckets", buckets,
+                          "framesPresented", (unsigned long long) stats->framesPresented,
+                          "framesSkipped", (unsigned long long) stats->framesSkipped,
+                          "attributeUpdates", (unsigned long long) stats->attributeUpdates,
+                          "exports", exports);
+}
+
+// function to read the layer's counters, reset=True starts them again from zero
+static PyObject *method_stats (dispmanxLayer *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"reset", NULL};
+    int reset = 0;
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "|p", kwlist, &reset)) {
+        return NULL;
+    }
+    if (!checkCreated (self)) {
+        return NULL;
+    }
+    IMAGE_LAYER_STATS_T stats;
+    lockLayer (self);
+    getStatsImageLayer (& (self->imageLayer), &stats);
+    if (reset) {
+        resetStatsImageLayer (& (self->imageLayer));
+    }
+    PyThread_release_lock (self->lock);
+    return statsDict (&stats, self->exports);
+}
+
+// convert an (r, g, b[, a]) sequence, alpha defaults to opaque
+static bool parseRGBA (PyObject *obj, RGBA8_T *rgb) {
+    rgb->alpha = 255;
+    if (PySequence_Check (obj) && PySequence_Size (obj) == 3) {
+        return PyArg_Parse (obj, "(bbb)", &rgb->red, &rgb->green, &rgb->blue);
+    }
+    if (!PySequence_Check (obj) || PySequence_Size (obj) != 4) {
+        PyErr_SetString (PyExc_TypeError, "colour must be an (r, g, b) or (r, g, b, a) sequence");
+        return false;
+    }
+    return PyArg_Parse (obj, "(bbbb)", &rgb->red, &rgb->green, &rgb->blue, &rgb->alpha);
+}
+
+// convert a python colour, a palette index for indexed layers or an (r, g, b[, a]) sequence for the others
+static bool parseColour (dispmanxLayer *self, PyObject *obj, RGBA8_T *rgb, int8_t *index) {
+    if (self->imageLayer.image.setPixelIndexed != NULL) {
+        long value = PyLong_AsLong (obj);
+        if (value == -1 && PyErr_Occurred ()) {
+            return false;
+        }
+        long maxIndex = (1 << self->imageLayer.image.bitsPerPixel) - 1;
+        if (value < 0 || value > maxIndex) {
+            PyErr_Format (PyExc_ValueError, "palette index must be between 0 and %ld", maxIndex);
+            return false;
+        }
+        *index = value;
+        return true;
+    }
+    return parseRGBA (obj, rgb);
+}
+
+// fill a rectangle of the buffer, clipped to the layer
+static bool drawRect (dispmanxLayer *self, VC_RECT_T *rect, PyObject *colour) {
+    RGBA8_T rgb;
+    int8_t index = 0;
+    if (!checkCreated (self) || !parseColour (self, colour, &rgb, &index)) {
+        return false;
+    }
+    IMAGE_T *image = & (self->imageLayer.image);
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock (self->lock, WAIT_LOCK);
+    if (image->setPixelIndexed != NULL) {
+        fillRectIndexed (image, rect->x, rect->y, rect->width, rect->height, index);
+    } else {
+        fillRectRGB (image, rect->x, rect->y, rect->width, rect->height, &rgb);
+    }
+    PyThread_release_lock (self->lock);
+    Py_END_ALLOW_THREADS
+    return true;
+}
+
+// function to fill an (x, y, width, height) rectangle with a colour
+static PyObject *method_fillRect (dispmanxLayer *self, PyObject *args) {
+    PyObject *rectArg, *colour;
+    VC_RECT_T rect;
+    if (!PyArg_ParseTuple (args, "OO", &rectArg, &colour) || !parseRect (rectArg, &rect) || !drawRect (self, &rect, colour)) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// function to draw a horizontal line
+static PyObject *method_hline (dispmanxLayer *self, PyObject *args) {
+    int32_t x, y, length;
+    PyObject *colour;
+    VC_RECT_T rect;
+    if (!PyArg_ParseTuple (args, "iiiO", &x, &y, &length, &colour)) {
+        return NULL;
+    }
+    vc_dispmanx_rect_set (&rect, x, y, length, 1);
+    if (!drawRect (self, &rect, colour)) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// function to draw a vertical line
+static PyObject *method_vline (dispmanxLayer *self, PyObject *args) {
+    int32_t x, y, length;
+    PyObject *colour;
+    VC_RECT_T rect;
+    if (!PyArg_ParseTuple (args, "iiiO", &x, &y, &length, &colour)) {
+        return NULL;
+    }
+    vc_dispmanx_rect_set (&rect, x, y, 1, length);
+    if (!drawRect (self, &rect, colour)) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// function to copy part of another buffer in the same pixel format into the layer
+static PyObject *method_blit (dispmanxLayer *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"source", "size", "pos", "area", "blend", "pitch", NULL};
+    PyObject *source;
+    int32_t width, height, x = 0, y = 0, pitch = 0;
+    PyObject *areaArg = Py_None;
+    int blend = 0;
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "O(ii)|(ii)Opi", kwlist, &source, &width, &height, &x, &y, &areaArg, &blend, &pitch)) {
+        return NULL;
+    }
+    if (!checkCreated (self)) {
+        return NULL;
+    }
+    VC_RECT_T area;
+    vc_dispmanx_rect_set (&area, 0, 0, width, height);
+    if (areaArg != Py_None && !parseRect (areaArg, &area)) {
+        return NULL;
+    }
+    IMAGE_T src = self->imageLayer.image;
+    src.width = width;
+    src.height = height;
+    src.pitch = pitch > 0 ? pitch : (width * src.bitsPerPixel + 7) / 8;
+    if (width <= 0 || height <= 0 || src.pitch < (width * src.bitsPerPixel + 7) / 8) {
+        PyErr_SetString (PyExc_ValueError, "invalid source size or pitch");
+        return NULL;
+    }
+
+    Py_buffer view;
+    if (PyObject_GetBuffer (source, &view, PyBUF_SIMPLE) < 0) {
+        return NULL;
+    }
+    if (view.len < (Py_ssize_t) src.pitch * (height - 1) + (width * src.bitsPerPixel + 7) / 8) {
+        PyBuffer_Release (&view);
+        PyErr_SetString (PyExc_ValueError, "source buffer is smaller than its size and pitch");
+        return NULL;
+    }
+    src.buffer = view.buf;
+    src.size = view.len;
+
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock (self->lock, WAIT_LOCK);
+    blitImage (& (self->imageLayer.image), x, y, &src, area.x, area.y, area.width, area.height, blend);
+    PyThread_release_lock (self->lock);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release (&view);
+    Py_RETURN_NONE;
+}
+
+// function to set palette entries of an indexed layer from start on, from a sequence of (r, g, b) colours
+static PyObject *method_setPalette (dispmanxLayer *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"colours", "start", NULL};
+    PyObject *colours;
+    int32_t start = 0;
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|i", kwlist, &colours, &start)) {
+        return NULL;
+    }
+    if (!checkCreated (self)) {
+        return NULL;
+    }
+    int32_t size = self->imageLayer.paletteSize;
+    if (size == 0) {
+        PyErr_SetString (PyExc_ValueError, "only 8BPP and 4BPP layers have a palette");
+        return NULL;
+    }
+    PyObject *seq = PySequence_Fast (colours, "colours must be a sequence of (r, g, b) colours");
+    if (seq == NULL) {
+        return NULL;
+    }
+    Py_ssize_t count = PySequence_Fast_GET_SIZE (seq);
+    if (start < 0 || start + count > size) {
+        Py_DECREF (seq);
+        PyErr_Format (PyExc_ValueError, "palette entries must be between 0 and %d", size - 1);
+        return NULL;
+    }
+    uint16_t entries[IMAGE_LAYER_MAX_PALETTE];
+    for (Py_ssize_t i = 0; i < count; i++) {
+        RGBA8_T rgb;
+        if (!parseRGBA (PySequence_Fast_GET_ITEM (seq, i), &rgb)) {
+            Py_DECREF (seq);
+            return NULL;
+        }
+        entries[i] = ((rgb.red >> 3) << 11) | ((rgb.green >> 2) << 5) | (rgb.blue >> 3);
+    }
+    Py_DECREF (seq);
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock (self->lock, WAIT_LOCK);
+    setPaletteImageLayer (& (self->imageLayer), entries, start, count);
+    PyThread_release_lock (self->lock);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef dispmanxMethods[] = {
+    {"updateLayer", (PyCFunction) method_updateLayer, METH_VARARGS | METH_KEYWORDS, "update display to show current buffer, optionally only the given (x, y, width, height) rectangles, block=False returns without waiting for the display"},
+    {"markDirty", (PyCFunction) method_markDirty, METH_VARARGS, "add an (x, y, width, height) rectangle to the region uploaded by the next update"},
+    {"fillRect", (PyCFunction) method_fillRect, METH_VARARGS, "fill an (x, y, width, height) rectangle with a colour"},
+    {"hline", (PyCFunction) method_hline, METH_VARARGS, "draw a horizontal line from x, y of the given length"},
+    {"vline", (PyCFunction) method_vline, METH_VARARGS, "draw a vertical line from x, y of the given length"},
+    {"blit", (PyCFunction) method_blit, METH_VARARGS | METH_KEYWORDS, "copy an area of a buffer in the layer's pixel format to pos, blending with its alpha if blend is true"},
+    {"setPalette", (PyCFunction) method_setPalette, METH_VARARGS | METH_KEYWORDS, "set palette entries of an indexed layer from start on to a sequence of (r, g, b) colours, shown without an update"},
+    {"stats", (PyCFunction) method_stats, METH_VARARGS | METH_KEYWORDS, "return the layer's upload and update counters as a dict, reset=True clears them"},
+    {"updateAsync", (PyCFunction) method_updateAsync, METH_VARARGS, "return an asyncio future that is done once the buffer, or the given (x, y, width, height) rectangles, are on screen"},
+    {"onVsync", (PyCFunction) method_onVsync, METH_VARARGS, "call callback(count, timestamp) from a background thread after every vsync, None stops it"},
+    {"move", (PyCFunction) method_move, METH_VARARGS | METH_KEYWORDS, "move the layer to x, y on the screen without uploading it, block=True waits for the display"},
+    {NULL}
+};
+
+// getter for the size of the display as part of the object
+static PyObject *dispmanx_getsize (dispmanxLayer *self, void *closure) {
+    if (!checkCreated (self)) {
+        return NULL;
+    }
+    return Py_BuildValue ("(ii)", self->imageLayer.image.width, self->imageLayer.image.height);
+}
+
+// getter for the area of the screen the layer is shown in
+static PyObject *dispmanx_getdest (dispmanxLayer *self, void *closure) {
+    if (!checkCreated (self)) {
+        return NULL;
+    }
+    VC_RECT_T *dest = &self->imageLayer.dstRect;
+    return Py_BuildValue ("(iiii)", dest->x, dest->y, dest->width, dest->height);
+}
+
+// getter for the name of the layer's pixel format
+static PyObject *dispmanx_getformat (dispmanxLayer *self, void *closure) {
+    return PyUnicode_FromString (self->format.name);
+}
+
+// getter and setter for the layer number, changing it restacks the layer without an upload
+static PyObject *dispmanx_getnumber (dispmanxLayer *self, void *closure) {
+    return PyLong_FromLong (self->number);
+}
+
+static int dispmanx_setnumber (dispmanxLayer *self, PyObject *value, void *closure) {
+    if (value == NULL) {
+        PyErr_SetString (PyExc_AttributeError, "cannot delete the layer number");
+        return -1;
+    }
+    int number = PyLong_AsLong (value);
+    if (number == -1 && PyErr_Occurred ()) {
+        return -1;
+    }
+    if (!checkCreated (self)) {
+        return -1;
+    }
+    self->number = number;
+    layerAttributes change = {.layer = number};
+    changeAttributes (self, ELEMENT_CHANGE_LAYER, &change, false);
+    return 0;
+}
+
+// getter and setter for the opacity the whole layer is shown with, 0 to 255
+static PyObject *dispmanx_getopacity (dispmanxLayer *self, void *closure) {
+    if (!checkCreated (self)) {
+        return NULL;
+    }
+    return PyLong_FromLong (self->imageLayer.opacity);
+}
+
+static int dispmanx_setopacity (dispmanxLayer *self, PyObject *value, void *closure) {
+    if (value == NULL) {
+        PyErr_SetString (PyExc_AttributeError, "cannot delete the opacity");
+        return -1;
+    }
+    long opacity = PyLong_AsLong (value);
+    if (opacity == -1 && PyErr_Occurred ()) {
+        return -1;
+    }
+    if (opacity < 0 || opacity > 255) {
+        PyErr_SetString (PyExc_ValueError, "opacity must be between 0 and 255");
+        return -1;
+    }
+    if (!checkCreated (self)) {
+        return -1;
+    }
+    layerAttributes change = {.opacity = opacity};
+    changeAttributes (self, ELEMENT_CHANGE_OPACITY, &change, false);
+    return 0;
+}
+
+// getter and setter for the rotation and flips the HVS applies when showing the layer
+static PyObject *dispmanx_gettransform (dispmanxLayer *self, void *closure) {
+    if (!checkCreated (self)) {
+        return NULL;
+    }
+    return PyLong_FromLong (self->imageLayer.transform);
+}
+
+static int dispmanx_settransform (dispmanxLayer *self, PyObject *value, void *closure) {
+    if (value == NULL) {
+        PyErr_SetString (PyExc_AttributeError, "cannot delete the transform");
+        return -1;
+    }
+    long transform = PyLong_AsLong (value);
+    if (transform == -1 && PyErr_Occurred ()) {
+        return -1;
+    }
+    if (!checkTransform (transform) || !checkCreated (self)) {
+        return -1;
+    }
+    // the buffer was sized for the rotation it was created with
+    if ((transform & DISPMANX_ROTATE_90) != (self->imageLayer.transform & DISPMANX_ROTATE_90)) {
+        PyErr_SetString (PyExc_ValueError, "can't switch between quarter turn and upright rotations, create a new layer instead");
+        return -1;
+    }
+    layerAttributes change = {.transform = transform};
+    changeAttributes (self, ELEMENT_CHANGE_TRANSFORM, &change, false);
+    return 0;
+}
+
+// getter for the palette of an indexed layer as a list of (r, g, b), None for direct colour layers
+static PyObject *dispmanx_getpalette (dispmanxLayer *self, void *closure) {
+    if (!checkCreated (self)) {
+        return NULL;
+    }
+    if (self->imageLayer.paletteSize == 0) {
+        Py_RETURN_NONE;
+    }
+    PyObject *palette = PyList_New (self->imageLayer.paletteSize);
+    if (palette == NULL) {
+        return NULL;
+    }
+    for (int32_t i = 0; i < self->imageLayer.paletteSize; i++) {
+        uint16_t entry = self->imageLayer.palette[i];
+        PyObject *colour = Py_BuildValue ("(iii)", ((entry >> 11) & 0x1F) * 255 / 31, ((entry >> 5) & 0x3F) * 255 / 63, (entry & 0x1F) * 255 / 31);
+        if (colour == NULL) {
+            Py_DECREF (palette);
+            return NULL;
+        }
+        PyList_SET_ITEM (palette, i, colour);
+    }
+    return palette;
+}
+
+// getter for whether the layer uploads from its own thread
+static PyObject *dispmanx_getpipeline (dispmanxLayer *self, void *closure) {
+    return PyBool_FromLong (self->imageLayer.pipeline != NULL);
+}
+
+// getter for whether unchanged rows are found by hashing and left out of updates
+static PyObject *dispmanx_getdetectchanges (dispmanxLayer *self, void *closure) {
+    return PyBool_FromLong (self->imageLayer.blockHash != NULL);
+}
+
+// getter for whether the buffer is VideoCore shared memory the GPU copies from directly
+static PyObject *dispmanx_getshared (dispmanxLayer *self, void *closure) {
+    return PyBool_FromLong (self->imageLayer.sharedHandle != 0);
+}
+
+// getter for the shared Display object the layer is shown on
+static PyObject *dispmanx_getdisplay (dispmanxLayer *self, void *closure) {
+    if (!checkCreated (self)) {
+        return NULL;
+    }
+    Py_INCREF (self->displayObj);
+    return (PyObject *) self->displayObj;
+}
+
+static PyGetSetDef dispmanx_getsetters[] = {
+    {"size", (getter) dispmanx_getsize, NULL, "buffer size", NULL},
+    {"display", (getter) dispmanx_getdisplay, NULL, "shared Display object the layer is shown on", NULL},
+    {"dest", (getter) dispmanx_getdest, NULL, "position and size on the screen", NULL},
+    {"number", (getter) dispmanx_getnumber, (setter) dispmanx_setnumber, "layer number, higher layers are shown on top", NULL},
+    {"opacity", (getter) dispmanx_getopacity, (setter) dispmanx_setopacity, "opacity of the whole layer, 0 to 255", NULL},
+    {"transform", (getter) dispmanx_gettransform, (setter) dispmanx_settransform, "rotation and flips, a ROTATE_* constant or'd with FLIP_HORIZONTAL and FLIP_VERTICAL", NULL},
+    {"format", (getter) dispmanx_getformat, NULL, "pixel format of the buffer", NULL},
+    {"palette", (getter) dispmanx_getpalette, NULL, "palette of an indexed layer as a list of (r, g, b), None for other formats", NULL},
+    {"pipeline", (getter) dispmanx_getpipeline, NULL, "True if updates are uploaded by a background thread", NULL},
+    {"detectChanges", (getter) dispmanx_getdetectchanges, NULL, "True if unchanged rows are found by hashing and not uploaded", NULL},
+    {"shared", (getter) dispmanx_getshared, NULL, "True if the buffer is VideoCore shared memory", NULL},
+    {NULL}  /* Sentinel */
+};
+
+static PyMemberDef dispmanxLayer_members[] = {
+    {"buffers", T_INT, offsetof (dispmanxLayer, buffers), READONLY, "number of GPU resources the layer cycles through"},
+    {"pitch", T_INT, offsetof (dispmanxLayer, imageLayer.image.pitch), READONLY, "bytes from the start of one buffer row to the next"},
+    {"exports", T_PYSSIZET, offsetof (dispmanxLayer, exports), READONLY, "number of buffer views currently holding the layer's memory"},
+    {NULL}
+};
+
+// shape and format of an exported image, channels of bytes for RGBA32 and RGB888,
+// one packed item per pixel for the 16 bit and 8BPP formats and raw bytes for 4BPP
+static void bufferLayout (IMAGE_T *image, Py_ssize_t *shape, Py_ssize_t *strides, Py_buffer *view) {
+    shape[0] = image->height;
+    strides[0] = image->pitch;
+    switch (image->type) {
+        case VC_IMAGE_RGBA32:
+        case VC_IMAGE_RGB888:
+            view->ndim = 3;
+            view->itemsize = sizeof (uint8_t);
+            view->format = "B";
+            shape[1] = image->width;
+            shape[2] = image->bitsPerPixel / 8;
+            strides[1] = image->bitsPerPixel / 8;
+            strides[2] = sizeof (uint8_t);
+            break;
+        case VC_IMAGE_RGB565:
+        case VC_IMAGE_RGBA16:
+            view->ndim = 2;
+            view->itemsize = sizeof (uint16_t);
+            view->format = "H";
+            shape[1] = image->width;
+            strides[1] = sizeof (uint16_t);
+            break;
+        default:
+            view->ndim = 2;
+            view->itemsize = sizeof (uint8_t);
+            view->format = "B";
+            shape[1] = (image->width * image->bitsPerPixel + 7) / 8;
+            strides[1] = sizeof (uint8_t);
+            break;
+    }
+}
+
+// fill in a view of an image owned by owner, rows are pitch bytes apart
+static int exportImage (PyObject *owner, IMAGE_T *image, Py_ssize_t *shape, Py_ssize_t *strides, Py_buffer *view, int flags) {
+    bufferLayout (image, shape, strides, view);
+    Py_ssize_t rowBytes = shape[1] * strides[1];
+    bool contiguous = rowBytes == image->pitch;
+
+    view->buf = (void *)image->buffer;
+    view->readonly = 0;
+    view->len = rowBytes * image->height;
+    if ((flags & PyBUF_ND) != PyBUF_ND) {
+        // simple consumers get every row as plain bytes, including any padding
+        view->len = (Py_ssize_t) image->pitch * image->height;
+        view->ndim = 1;
+        view->itemsize = sizeof (uint8_t);
+        view->format = "B";
+        view->shape = NULL;
+    } else {
+        view->shape = shape;
+    }
+    if ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) {
+        view->strides = view->shape != NULL ? strides : NULL;
+    } else if (!contiguous && view->shape != NULL) {
+        PyErr_SetString (PyExc_BufferError, "rows are padded, strides are needed");
+        view->obj = NULL;
+        return -1;
+    } else {
+        view->strides = NULL;
+    }
+    if (!contiguous && view->shape != NULL &&
+        ((flags & PyBUF_ANY_CONTIGUOUS) == PyBUF_ANY_CONTIGUOUS ||
+         (flags & PyBUF_C_CONTIGUOUS) == PyBUF_C_CONTIGUOUS ||
+         (flags & PyBUF_F_CONTIGUOUS) == PyBUF_F_CONTIGUOUS)) {
+        PyErr_SetString (PyExc_BufferError, "rows are padded and not contiguous");
+        view->obj = NULL;
+        return -1;
+    }
+    if ((flags & PyBUF_FORMAT) != PyBUF_FORMAT) {
+        view->format = NULL;
+    }
+    view->suboffsets = NULL;
+    view->internal = NULL;
+
+    // the view keeps the owner alive until PyBuffer_Release drops this reference
+    view->obj = owner;
+    Py_INCREF (owner);
+    return 0;
+}
+
+// setup the buffer interface to access the underlying buffer
+static int dispmanxLayer_getbuffer (dispmanxLayer *self, Py_buffer *view, int flags) {
+    if (view == NULL) {
+        PyErr_SetString (PyExc_ValueError, "NULL view in getbuffer");
+        return -1;
+    }
+    if (!checkCreated (self)) {
+        view->obj = NULL;
+        return -1;
+    }
+    if (exportImage ((PyObject *) self, &self->imageLayer.image, self->bufferShape, self->bufferStrides, view, flags) < 0) {
+        return -1;
+    }
+    self->exports++;
+    return 0;
+}
+
+static void dispmanxLayer_releasebuffer (dispmanxLayer *self, Py_buffer *view) {
+    self->exports--;
+}
+
+static PyBufferProcs dispmanxLayer_as_buffer = {
+    (getbufferproc)dispmanxLayer_getbuffer,
+    (releasebufferproc)dispmanxLayer_releasebuffer,
+};
+
+// object definition
+static PyTypeObject dispmanxLayerType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    .tp_name = "dispmanx.dispmanxLayer",
+    .tp_doc = "displamanx layer",
+    .tp_basicsize = sizeof (dispmanxLayer),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT || Py_TPFLAGS_BASETYPE,
+    .tp_new = dispmanxLayer_new,
+    .tp_init = (initproc)dispmanxLayer_init,
+    .tp_dealloc = (destructor) dispmanxLayer_dealloc,
+    .tp_members = dispmanxLayer_members,
+    .tp_methods = dispmanxMethods,
+    .tp_getset = dispmanx_getsetters,
+    .tp_as_buffer = &dispmanxLayer_as_buffer,
+};
+
+// order layers by address so several layers are always locked in the same order
+static int compareLayers (const void *a, const void *b) {
+    uintptr_t la = (uintptr_t) *(dispmanxLayer * const *) a;
+    uintptr_t lb = (uintptr_t) *(dispmanxLayer * const *) b;
+    return (la > lb) - (la < lb);
+}
+
+// upload every layer in the sequence and show them all with a single dispmanx update
+static bool commitLayers (PyObject *layers, int block) {
+    PyObject *seq = PySequence_Fast (layers, "layers must be a sequence of dispmanxLayer");
+    if (seq == NULL) {
+        return false;
+    }
+    Py_ssize_t count = PySequence_Fast_GET_SIZE (seq);
+    dispmanxLayer **layer = PyMem_New (dispmanxLayer *, count + 1);
+    IMAGE_LAYER_T **imageLayer = PyMem_New (IMAGE_LAYER_T *, count + 1);
+    if (layer == NULL || imageLayer == NULL) {
+        PyMem_Free (layer);
+        PyMem_Free (imageLayer);
+        Py_DECREF (seq);
+        PyErr_NoMemory ();
+        return false;
+    }
+    Py_ssize_t unique = 0;
+    for (Py_ssize_t i = 0; i < count; i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM (seq, i);
+        if (!PyObject_TypeCheck (item, &dispmanxLayerType)) {
+            PyErr_SetString (PyExc_TypeError, "layers must be a sequence of dispmanxLayer");
+            break;
+        }
+        if (!checkCreated ((dispmanxLayer *) item)) {
+            break;
+        }
+        if (((dispmanxLayer *) item)->imageLayer.pipeline != NULL) {
+            PyErr_SetString (PyExc_ValueError, "pipelined layers upload on their own thread and can't be committed together");
+            break;
+        }
+        bool duplicate = false;
+        for (Py_ssize_t j = 0; j < unique; j++) {
+            if (layer[j] == (dispmanxLayer *) item) {
+                duplicate = true;
+            }
+        }
+        if (!duplicate) {
+            layer[unique++] = (dispmanxLayer *) item;
+        }
+    }
+
+    if (!PyErr_Occurred () && unique > 0) {
+        qsort (layer, unique, sizeof (dispmanxLayer *), compareLayers);
+        Py_BEGIN_ALLOW_THREADS
+        for (Py_ssize_t i = 0; i < unique; i++) {
+            PyThread_acquire_lock (layer[i]->lock, WAIT_LOCK);
+        }
+        // layers whose change detection found nothing new are left out
+        Py_ssize_t changed = 0;
+        for (Py_ssize_t i = 0; i < unique; i++) {
+            if (findChangesImageLayer (& (layer[i]->imageLayer))) {
+                imageLayer[changed++] = & (layer[i]->imageLayer);
+            } else {
+                skipUpdateImageLayer (& (layer[i]->imageLayer));
+            }
+        }
+        if (changed > 0) {
+            DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start (0);
+            for (Py_ssize_t i = 0; i < changed; i++) {
+                changeSourceImageLayer (imageLayer[i], update);
+            }
+            submitUpdateImageLayers (imageLayer, changed, update, false);
+        }
+        for (Py_ssize_t i = 0; i < unique; i++) {
+            PyThread_release_lock (layer[i]->lock);
+        }
+        if (block) {
+            for (Py_ssize_t i = 0; i < changed; i++) {
+                waitForUpdatesImageLayer (imageLayer[i], 0);
+            }
+        }
+        Py_END_ALLOW_THREADS
+    }
+
+    PyMem_Free (layer);
+    PyMem_Free (imageLayer);
+    Py_DECREF (seq);
+    return !PyErr_Occurred ();
+}
+
+// Python update transaction object struct
+typedef struct {
+    PyObject_HEAD
+    PyObject *layers;
+    int block;
+} dispmanxUpdate;
+
+static int dispmanxUpdate_init (dispmanxUpdate *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"layers", "block", NULL};
+    PyObject *layers = NULL;
+    self->block = 1;
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "|Op", kwlist, &layers, &self->block)) {
+        return -1;
+    }
+    Py_XSETREF (self->layers, layers ? PySequence_List (layers) : PyList_New (0));
+    return self->layers ? 0 : -1;
+}
+
+static void dispmanxUpdate_dealloc (dispmanxUpdate *self) {
+    Py_XDECREF (self->layers);
+    Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+// add a layer to the transaction, marking any (x, y, width, height) rectangles given as dirty
+static PyObject *method_updateAdd (dispmanxUpdate *self, PyObject *args) {
+    if (self->layers == NULL && (self->layers = PyList_New (0)) == NULL) {
+        return NULL;
+    }
+    Py_ssize_t count = PyTuple_GET_SIZE (args);
+    if (count < 1 || !PyObject_TypeCheck (PyTuple_GET_ITEM (args, 0), &dispmanxLayerType)) {
+        PyErr_SetString (PyExc_TypeError, "add() takes a dispmanxLayer followed by optional rectangles");
+        return NULL;
+    }
+    dispmanxLayer *layer = (dispmanxLayer *) PyTuple_GET_ITEM (args, 0);
+    if (!checkCreated (layer)) {
+        return NULL;
+    }
+    for (Py_ssize_t i = 1; i < count; i++) {
+        VC_RECT_T rect;
+        if (!parseRect (PyTuple_GET_ITEM (args, i), &rect)) {
+            return NULL;
+        }
+        lockLayer (layer);
+        markDirtyImageLayer (& (layer->imageLayer), &rect);
+        PyThread_release_lock (layer->lock);
+    }
+    if (PyList_Append (self->layers, (PyObject *) layer) < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// show every layer added so far in one update and start a new transaction
+static PyObject *method_updateCommit (dispmanxUpdate *self, PyObject *args) {
+    if (self->layers == NULL) {
+        Py_RETURN_NONE;
+    }
+    PyObject *layers = self->layers;
+    self->layers = PyList_New (0);
+    bool committed = commitLayers (layers, self->block);
+    Py_DECREF (layers);
+    if (!committed) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *method_updateEnter (dispmanxUpdate *self, PyObject *args) {
+    Py_INCREF (self);
+    return (PyObject *) self;
+}
+
+// commit when the with block finishes normally, drop the transaction if it raised
+static PyObject *method_updateExit (dispmanxUpdate *self, PyObject *args) {
+    PyObject *excType, *excValue, *traceback;
+    if (!PyArg_ParseTuple (args, "OOO", &excType, &excValue, &traceback)) {
+        return NULL;
+    }
+    if (excType != Py_None) {
+        Py_XSETREF (self->layers, PyList_New (0));
+        Py_RETURN_FALSE;
+    }
+    PyObject *result = method_updateCommit (self, NULL);
+    if (result == NULL) {
+        return NULL;
+    }
+    Py_DECREF (result);
+    Py_RETURN_FALSE;
+}
+
+static PyMethodDef dispmanxUpdateMethods[] = {
+    {"add", (PyCFunction) method_updateAdd, METH_VARARGS, "add a layer to the update, optionally with (x, y, width, height) rectangles that changed"},
+    {"commit", (PyCFunction) method_updateCommit, METH_NOARGS, "show every layer added in a single display update"},
+    {"__enter__", (PyCFunction) method_updateEnter, METH_NOARGS, "start the update"},
+    {"__exit__", (PyCFunction) method_updateExit, METH_VARARGS, "commit the update unless the block raised"},
+    {NULL}
+};
+
+static PyMemberDef dispmanxUpdate_members[] = {
+    {"block", T_BOOL, offsetof (dispmanxUpdate, block), 0, "wait for the display when committing"},
+    {NULL}
+};
+
+// object definition
+static PyTypeObject dispmanxUpdateType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    .tp_name = "dispmanx.Update",
+    .tp_doc = "update changing several layers on the same vsync",
+    .tp_basicsize = sizeof (dispmanxUpdate),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc) dispmanxUpdate_init,
+    .tp_dealloc = (destructor) dispmanxUpdate_dealloc,
+    .tp_members = dispmanxUpdate_members,
+    .tp_methods = dispmanxUpdateMethods,
+};
+
+// Display returns the shared object for the default or given display
+static PyObject *dispmanxDisplay_new (PyTypeObject *type, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"display", NULL};
+    int displayArg = -1;
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "|i", kwlist, &displayArg)) {
+        return NULL;
+    }
+    bool found;
+    uint8_t displayId = DEFAULT_DISPLAY;
+    Py_BEGIN_ALLOW_THREADS
+    found = defaultDisplay (&displayId);
+    if (found && displayArg >= 0) {
+        found = displayArg < TV_MAX_ATTACHED_DISPLAYS && displayAttached (displayArg);
+        displayId = displayArg;
+    }
+    Py_END_ALLOW_THREADS
+    if (!found) {
+        PyErr_SetString(PyExc_ValueError, displayArg >= 0 ? "Display ID invalid" : "No display connected");
+        return NULL;
+    }
+    return (PyObject *) getDisplay (displayId);
+}
+
+// only reached if the module itself is torn down
+static void dispmanxDisplay_dealloc (dispmanxDisplay *self) {
+    Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+// read the cached mode for a getter, raising if the display can't be opened
+static bool displayState (dispmanxDisplay *self, DISPMANX_MODEINFO_T *info, TV_DISPLAY_STATE_T *tvstate, bool *ntsc) {
+    bool valid;
+    Py_BEGIN_ALLOW_THREADS
+    valid = readDisplay (self, info, tvstate, ntsc);
+    Py_END_ALLOW_THREADS
+    if (!valid) {
+        PyErr_SetString(PyExc_RuntimeError, "Unable to open display");
+    }
+    return valid;
+}
+
+static PyObject *display_getid (dispmanxDisplay *self, void *closure) {
+    return PyLong_FromLong (self->displayId);
+}
+
+static PyObject *display_getsize (dispmanxDisplay *self, void *closure) {
+    DISPMANX_MODEINFO_T info;
+    TV_DISPLAY_STATE_T tvstate;
+    if (!displayState (self, &info, &tvstate, NULL)) {
+        return NULL;
+    }
+    pixelAspectRatio par = getPixelAspect(&tvstate);
+    return Py_BuildValue ("(ii)", par.displayWidth, info.height);
+}
+
+static PyObject *display_getframerate (dispmanxDisplay *self, void *closure) {
+    TV_DISPLAY_STATE_T tvstate;
+    bool ntsc;
+    if (!displayState (self, NULL, &tvstate, &ntsc)) {
+        return NULL;
+    }
+    return Py_BuildValue ("f", frameRateOf (&tvstate, ntsc));
+}
+
+static PyObject *display_getpixelaspect (dispmanxDisplay *self, void *closure) {
+    TV_DISPLAY_STATE_T tvstate;
+    if (!displayState (self, NULL, &tvstate, NULL)) {
+        return NULL;
+    }
+    pixelAspectRatio par = getPixelAspect(&tvstate);
+    return Py_BuildValue ("(ii)", par.parWidth, par.parHeight);
+}
+
+// drop the cached mode so the next read asks the firmware again
+static PyObject *method_displayRefresh (dispmanxDisplay *self, PyObject *args) {
+    pthread_mutex_lock (&displayLock);
+    self->cached = false;
+    devicesCached = false;
+    pthread_mutex_unlock (&displayLock);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef dispmanxDisplayMethods[] = {
+    {"refresh", (PyCFunction) method_displayRefresh, METH_NOARGS, "forget the cached mode and read it again on next use"},
+    {NULL}
+};
+
+static PyGetSetDef dispmanxDisplay_getsetters[] = {
+    {"id", (getter) display_getid, NULL, "display id", NULL},
+    {"size", (getter) display_getsize, NULL, "display size in square pixels", NULL},
+    {"frameRate", (getter) display_getframerate, NULL, "display frame rate", NULL},
+    {"pixelAspectRatio", (getter) display_getpixelaspect, NULL, "pixel aspect ratio as a tuple", NULL},
+    {NULL}
+};
+
+// object definition
+static PyTypeObject dispmanxDisplayType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    .tp_name = "dispmanx.Display",
+    .tp_doc = "display shared by every layer shown on it, with its mode cached",
+    .tp_basicsize = sizeof (dispmanxDisplay),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = dispmanxDisplay_new,
+    .tp_dealloc = (destructor) dispmanxDisplay_dealloc,
+    .tp_methods = dispmanxDisplayMethods,
+    .tp_getset = dispmanxDisplay_getsetters,
+};
+
+// Python sprite atlas object struct
+typedef struct {
+    PyObject_HEAD
+    bool created;
+    IMAGE_TYPE_INFO_T format;
+    Py_ssize_t bufferShape[3];
+    Py_ssize_t bufferStrides[3];
+    Py_ssize_t exports;
+    SPRITE_ATLAS_T atlas;
+} dispmanxAtlas;
+
+// create the atlas image and its resource, drawn into through the buffer interface and sent with upload()
+static int dispmanxAtlas_init (dispmanxAtlas *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"size", "format", NULL};
+    int32_t width, height;
+    const char *formatName = "RGBA32";
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "(ii)|s", kwlist, &width, &height, &formatName)) {
+        return -1;
+    }
+    if (width <= 0 || height <= 0) {
+        PyErr_SetString(PyExc_ValueError, "size must be positive");
+        return -1;
+    }
+    if (!findImageType (&self->format, formatName, IMAGE_TYPES_ALL)) {
+        PyErr_Format(PyExc_ValueError, "unknown format %s", formatName);
+        return -1;
+    }
+    // an atlas has no palette, so indexed pixels would show whatever the resource was left with
+    if (self->format.type == VC_IMAGE_8BPP || self->format.type == VC_IMAGE_4BPP) {
+        PyErr_SetString(PyExc_ValueError, "atlas format must be a direct colour format");
+        return -1;
+    }
+    if (self->created) {
+        PyErr_SetString(PyExc_RuntimeError, "Atlas already created");
+        return -1;
+    }
+    bool created;
+    Py_BEGIN_ALLOW_THREADS
+    created = initSpriteAtlas (& (self->atlas), self->format.type, width, height);
+    Py_END_ALLOW_THREADS
+    if (!created) {
+        PyErr_NoMemory ();
+        return -1;
+    }
+    self->created = true;
+    return 0;
+}
+
+// sprites and buffer views hold a reference, so nothing shows the atlas any more
+static void dispmanxAtlas_dealloc (dispmanxAtlas *self) {
+    if (self->created) {
+        Py_BEGIN_ALLOW_THREADS
+        destroySpriteAtlas (& (self->atlas));
+        Py_END_ALLOW_THREADS
+    }
+    Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+static bool checkAtlas (dispmanxAtlas *self) {
+    if (!self->created) {
+        PyErr_SetString(PyExc_RuntimeError, "Atlas not created");
+        return false;
+    }
+    return true;
+}
+
+// function to send the atlas to the GPU, whole or just the rows of the (x, y, width, height) rectangles given
+static PyObject *method_atlasUpload (dispmanxAtlas *self, PyObject *args) {
+    if (!checkAtlas (self)) {
+        return NULL;
+    }
+    Py_ssize_t count = PyTuple_GET_SIZE (args);
+    VC_RECT_T *rects = PyMem_New (VC_RECT_T, count > 0 ? count : 1);
+    if (rects == NULL) {
+        return PyErr_NoMemory ();
+    }
+    if (count == 0) {
+        vc_dispmanx_rect_set (&rects[0], 0, 0, self->atlas.image.width, self->atlas.image.height);
+        count = 1;
+    } else {
+        for (Py_ssize_t i = 0; i < count; i++) {
+            if (!parseRect (PyTuple_GET_ITEM (args, i), &rects[i])) {
+                PyMem_Free (rects);
+                return NULL;
+            }
+        }
+    }
+    Py_BEGIN_ALLOW_THREADS
+    for (Py_ssize_t i = 0; i < count; i++) {
+        uploadSpriteAtlas (& (self->atlas), &rects[i]);
+    }
+    Py_END_ALLOW_THREADS
+    PyMem_Free (rects);
+    Py_RETURN_NONE;
+}
+
+static PyObject *atlas_getsize (dispmanxAtlas *self, void *closure) {
+    if (!checkAtlas (self)) {
+        return NULL;
+    }
+    return Py_BuildValue ("(ii)", self->atlas.image.width, self->atlas.image.height);
+}
+
+static PyObject *atlas_getformat (dispmanxAtlas *self, void *closure) {
+    return PyUnicode_FromString (self->format.name);
+}
+
+static int dispmanxAtlas_getbuffer (dispmanxAtlas *self, Py_buffer *view, int flags) {
+    if (view == NULL) {
+        PyErr_SetString (PyExc_ValueError, "NULL view in getbuffer");
+        return -1;
+    }
+    if (!checkAtlas (self)) {
+        view->obj = NULL;
+        return -1;
+    }
+    if (exportImage ((PyObject *) self, &self->atlas.image, self->bufferShape, self->bufferStrides, view, flags) < 0) {
+        return -1;
+    }
+    self->exports++;
+    return 0;
+}
+
+static void dispmanxAtlas_releasebuffer (dispmanxAtlas *self, Py_buffer *view) {
+    self->exports--;
+}
+
+static PyBufferProcs dispmanxAtlas_as_buffer = {
+    (getbufferproc)dispmanxAtlas_getbuffer,
+    (releasebufferproc)dispmanxAtlas_releasebuffer,
+};
+
+static PyMethodDef dispmanxAtlasMethods[] = {
+    {"upload", (PyCFunction) method_atlasUpload, METH_VARARGS, "send the atlas to the GPU, optionally only the rows of (x, y, width, height) rectangles"},
+    {NULL}
+};
+
+static PyGetSetDef dispmanxAtlas_getsetters[] = {
+    {"size", (getter) atlas_getsize, NULL, "atlas size", NULL},
+    {"format", (getter) atlas_getformat, NULL, "pixel format of the atlas", NULL},
+    {NULL}  /* Sentinel */
+};
+
+static PyMemberDef dispmanxAtlas_members[] = {
+    {"pitch", T_INT, offsetof (dispmanxAtlas, atlas.image.pitch), READONLY, "bytes from the start of one buffer row to the next"},
+    {"exports", T_PYSSIZET, offsetof (dispmanxAtlas, exports), READONLY, "number of buffer views currently holding the atlas memory"},
+    {NULL}
+};
+
+// object definition
+static PyTypeObject dispmanxAtlasType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    .tp_name = "dispmanx.Atlas",
+    .tp_doc = "image uploaded once to the GPU for sprites to show parts of",
+    .tp_basicsize = sizeof (dispmanxAtlas),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc) dispmanxAtlas_init,
+    .tp_dealloc = (destructor) dispmanxAtlas_dealloc,
+    .tp_members = dispmanxAtlas_members,
+    .tp_methods = dispmanxAtlasMethods,
+    .tp_getset = dispmanxAtlas_getsetters,
+    .tp_as_buffer = &dispmanxAtlas_as_buffer,
+};
+
+// Python sprite object struct
+typedef struct {
+    PyObject_HEAD
+    bool created;
+    SPRITE_T sprite;
+    dispmanxAtlas *atlas;
+    dispmanxDisplay *displayObj;
+} dispmanxSprite;
+
+static PyTypeObject dispmanxSpriteType;
+
+// check a frame lies inside the atlas
+static bool checkFrame (dispmanxAtlas *atlas, const VC_RECT_T *frame) {
+    if (frame->x < 0 || frame->y < 0 || frame->width <= 0 || frame->height <= 0 ||
+        frame->x + frame->width > atlas->atlas.image.width ||
+        frame->y + frame->height > atlas->atlas.image.height) {
+        PyErr_SetString(PyExc_ValueError, "frame must lie inside the atlas");
+        return false;
+    }
+    return true;
+}
+
+// show frame of the atlas as its own element, at its natural size unless size is given
+static int dispmanxSprite_init (dispmanxSprite *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"atlas", "frame", "pos", "size", "layer", "opacity", "display", NULL};
+    dispmanxAtlas *atlas;
+    PyObject *frameArg;
+    int32_t x = 0, y = 0;
+    PyObject *sizeArg = NULL;
+    int32_t layer = 1;
+    int opacity = 255;
+    PyObject *displayArg = NULL;
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "O!O|(ii)OiiO", kwlist, &dispmanxAtlasType, &atlas, &frameArg, &x, &y, &sizeArg, &layer, &opacity, &displayArg)) {
+        return -1;
+    }
+    if (self->created) {
+        PyErr_SetString(PyExc_RuntimeError, "Sprite already created");
+        return -1;
+    }
+    VC_RECT_T frame;
+    if (!checkAtlas (atlas) || !parseRect (frameArg, &frame) || !checkFrame (atlas, &frame)) {
+        return -1;
+    }
+    int32_t width = frame.width, height = frame.height;
+    if (sizeArg != NULL && sizeArg != Py_None) {
+        if (!PyArg_Parse (sizeArg, "(ii)", &width, &height)) {
+            return -1;
+        }
+        if (width <= 0 || height <= 0) {
+            PyErr_SetString(PyExc_ValueError, "size must be positive");
+            return -1;
+        }
+    }
+    if (opacity < 0 || opacity > 255) {
+        PyErr_SetString(PyExc_ValueError, "opacity must be between 0 and 255");
+        return -1;
+    }
+    // the display is either an id or a shared Display object, the default display if not given
+    dispmanxDisplay *display;
+    if (displayArg != NULL && PyObject_TypeCheck (displayArg, &dispmanxDisplayType)) {
+        Py_INCREF (displayArg);
+        display = (dispmanxDisplay *) displayArg;
+    } else if (displayArg != NULL && displayArg != Py_None) {
+        display = (dispmanxDisplay *) PyObject_CallFunctionObjArgs ((PyObject *) &dispmanxDisplayType, displayArg, NULL);
+    } else {
+        display = (dispmanxDisplay *) PyObject_CallNoArgs ((PyObject *) &dispmanxDisplayType);
+    }
+    if (display == NULL) {
+        return -1;
+    }
+
+    SPRITE_T *sprite = &self->sprite;
+    setFrameSprite (sprite, &frame);
+    vc_dispmanx_rect_set (&sprite->dstRect, x, y, width, height);
+    sprite->layer = layer;
+    sprite->opacity = opacity;
+
+    DISPMANX_DISPLAY_HANDLE_T handle;
+    Py_BEGIN_ALLOW_THREADS
+    handle = holdDisplay (display);
+    if (handle != DISPMANX_NO_HANDLE) {
+        DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start (0);
+        addElementSprite (sprite, & (atlas->atlas), handle, update);
+        submitUpdateSprites (update, false);
+    }
+    Py_END_ALLOW_THREADS
+    if (handle == DISPMANX_NO_HANDLE) {
+        Py_DECREF (display);
+        PyErr_SetString(PyExc_RuntimeError, "Unable to open display");
+        return -1;
+    }
+    Py_INCREF (atlas);
+    self->atlas = atlas;
+    self->displayObj = display;
+    self->created = true;
+    return 0;
+}
+
+static void dispmanxSprite_dealloc (dispmanxSprite *self) {
+    if (self->created) {
+        Py_BEGIN_ALLOW_THREADS
+        DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start (0);
+        removeSprite (& (self->sprite), update);
+        submitUpdateSprites (update, false);
+        releaseDisplay (self->displayObj);
+        Py_END_ALLOW_THREADS
+    }
+    Py_CLEAR (self->atlas);
+    Py_CLEAR (self->displayObj);
+    Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+static bool checkSprite (dispmanxSprite *self) {
+    if (!self->created) {
+        PyErr_SetString(PyExc_RuntimeError, "Sprite not created");
+        return false;
+    }
+    return true;
+}
+
+// send the attributes selected by changeFlags, keeping at most one sprite update queued
+static void changeSprite (dispmanxSprite *self, uint32_t changeFlags, bool block) {
+    SPRITE_T sprite = self->sprite;
+    Py_BEGIN_ALLOW_THREADS
+    waitForUpdatesSprites (1);
+    DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start (0);
+    changeAttributesSprite (&sprite, changeFlags, update);
+    submitUpdateSprites (update, block);
+    Py_END_ALLOW_THREADS
+}
+
+// function to move the sprite on the screen
+static PyObject *method_spriteMove (dispmanxSprite *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"x", "y", "block", NULL};
+    int32_t x, y;
+    int block = 0;
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "ii|p", kwlist, &x, &y, &block)) {
+        return NULL;
+    }
+    if (!checkSprite (self)) {
+        return NULL;
+    }
+    self->sprite.dstRect.x = x;
+    self->sprite.dstRect.y = y;
+    changeSprite (self, ELEMENT_CHANGE_DEST_RECT, block);
+    Py_RETURN_NONE;
+}
+
+// getter and setter for the top left corner on the screen
+static PyObject *sprite_getpos (dispmanxSprite *self, void *closure) {
+    if (!checkSprite (self)) {
+        return NULL;
+    }
+    return Py_BuildValue ("(ii)", self->sprite.dstRect.x, self->sprite.dstRect.y);
+}
+
+static int sprite_setpos (dispmanxSprite *self, PyObject *value, void *closure) {
+    int32_t x, y;
+    if (value == NULL || !PyArg_Parse (value, "(ii)", &x, &y)) {
+        PyErr_SetString(PyExc_TypeError, "pos must be an (x, y) tuple");
+        return -1;
+    }
+    if (!checkSprite (self)) {
+        return -1;
+    }
+    self->sprite.dstRect.x = x;
+    self->sprite.dstRect.y = y;
+    changeSprite (self, ELEMENT_CHANGE_DEST_RECT, false);
+    return 0;
+}
+
+// getter and setter for the size on the screen, the HVS scales the frame to it
+static PyObject *sprite_getsize (dispmanxSprite *self, void *closure) {
+    if (!checkSprite (self)) {
+        return NULL;
     }
-    return (PyObject *) self;
+    return Py_BuildValue ("(ii)", self->sprite.dstRect.width, self->sprite.dstRect.height);
 }
 
-// create a fullscreen transparent layer when a new object is created
-static int dispmanxLayer_init (dispmanxLayer *self, PyObject *args, PyObject *kwds)  {
-    if (!PyArg_ParseTuple (args, "i|b", &self->number, &self->displayId)) {
+static int sprite_setsize (dispmanxSprite *self, PyObject *value, void *closure) {
+    int32_t width, height;
+    if (value == NULL || !PyArg_Parse (value, "(ii)", &width, &height)) {
+        PyErr_SetString(PyExc_TypeError, "size must be a (width, height) tuple");
         return -1;
     }
-
-    TV_ATTACHED_DEVICES_T devices;
-    if (vc_tv_get_attached_devices(&devices) == -1) {
+    if (width <= 0 || height <= 0) {
+        PyErr_SetString(PyExc_ValueError, "size must be positive");
         return -1;
     }
-    if (devices.num_attached<1) {
-        PyErr_SetString(PyExc_RuntimeError, "No display connected");
+    if (!checkSprite (self)) {
         return -1;
     }
-    bool found = false;
-    for(uint32_t i = 0; i < devices.num_attached; i++) {
-        if(devices.display_number[i] == self->displayId) {
-             found = true;
-        }
+    self->sprite.dstRect.width = width;
+    self->sprite.dstRect.height = height;
+    changeSprite (self, ELEMENT_CHANGE_DEST_RECT, false);
+    return 0;
+}
+
+// getter and setter for the part of the atlas shown, changing it animates the sprite without an upload
+static PyObject *sprite_getframe (dispmanxSprite *self, void *closure) {
+    if (!checkSprite (self)) {
+        return NULL;
     }
-    if(!found){
-        PyErr_SetString(PyExc_ValueError, "Display ID invalid");
+    VC_RECT_T *src = &self->sprite.srcRect;
+    return Py_BuildValue ("(iiii)", src->x >> 16, src->y >> 16, src->width >> 16, src->height >> 16);
+}
+
+static int sprite_setframe (dispmanxSprite *self, PyObject *value, void *closure) {
+    VC_RECT_T frame;
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "Cannot delete the frame attribute");
         return -1;
     }
-
-    self->display = vc_dispmanx_display_open (self->displayId);
-    if (self->display == 0) {
-        vc_dispmanx_display_close (self->display);
+    if (!checkSprite (self) || !parseRect (value, &frame) || !checkFrame (self->atlas, &frame)) {
         return -1;
     }
-    DISPMANX_MODEINFO_T info;
-    vc_dispmanx_display_get_info (self->display, &info);
-    TV_DISPLAY_STATE_T tvstate;
-    vc_tv_get_display_state_id( self->displayId, &tvstate);
-    pixelAspectRatio par = getPixelAspect(&tvstate);
-    initImage (& (self->imageLayer.image), VC_IMAGE_RGBA32, par.displayWidth, info.height, true);
-    createResourceImageLayer (& (self->imageLayer), self->number);
-    DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start (0);
-    addElementImageLayerOffset (& (self->imageLayer), 0, 0, &info, self->display, update);
-    vc_dispmanx_update_submit_sync (update);
+    setFrameSprite (& (self->sprite), &frame);
+    changeSprite (self, ELEMENT_CHANGE_SRC_RECT, false);
     return 0;
 }
 
-
-// when the object is deleted delete both the layer and the display
-static void dispmanxLayer_dealloc (dispmanxLayer *self) {
-    destroyImageLayer (& (self->imageLayer));
-    vc_dispmanx_display_close (self->display);
+// getter and setter for the layer number, higher layers are shown on top
+static PyObject *sprite_getlayer (dispmanxSprite *self, void *closure) {
+    return PyLong_FromLong (self->sprite.layer);
 }
 
-// function to trigger an update to the display
-static PyObject *method_updateLayer (dispmanxLayer *self, PyObject *args) {
-    DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start (0);
-    changeSourceImageLayer (& (self->imageLayer), update);
-    vc_dispmanx_update_submit_sync (update);
-    Py_RETURN_TRUE;
+static int sprite_setlayer (dispmanxSprite *self, PyObject *value, void *closure) {
+    if (value == NULL || !PyLong_Check (value)) {
+        PyErr_SetString(PyExc_TypeError, "layer must be an int");
+        return -1;
+    }
+    int32_t layer = PyLong_AsLong (value);
+    if (layer == -1 && PyErr_Occurred ()) {
+        return -1;
+    }
+    if (!checkSprite (self)) {
+        return -1;
+    }
+    self->sprite.layer = layer;
+    changeSprite (self, ELEMENT_CHANGE_LAYER, false);
+    return 0;
 }
 
-static PyMethodDef dispmanxMethods[] = {
-    {"updateLayer", (PyCFunction) method_updateLayer, METH_NOARGS, "update display to show current buffer"},
-    {NULL}
-};
-
-// getter for the size of the display as part of the object
-static PyObject *dispmanx_getsize (dispmanxLayer *self, void *closure) {
-    DISPMANX_MODEINFO_T info;
-    vc_dispmanx_display_get_info (self->display, &info);
-    TV_DISPLAY_STATE_T tvstate;
-    vc_tv_get_display_state_id( self->displayId, &tvstate);
-    pixelAspectRatio par = getPixelAspect(&tvstate);
-    return Py_BuildValue ("(ii)", par.displayWidth, info.height);
+// getter and setter for the opacity of the whole sprite
+static PyObject *sprite_getopacity (dispmanxSprite *self, void *closure) {
+    return PyLong_FromLong (self->sprite.opacity);
 }
 
-static PyGetSetDef dispmanx_getsetters[] = {
-    {"size", (getter) dispmanx_getsize, NULL, "display size", NULL},
-    {NULL}  /* Sentinel */
-};
-
-static PyMemberDef dispmanxLayer_members[] = {
-    {"number", T_INT, offsetof (dispmanxLayer, number), 0, "layer number"},
-    {NULL}
-};
-
-// setup the buffer interface to access the underlying buffer
-static int dispmanxLayer_getbuffer (dispmanxLayer *self, Py_buffer *view, int flags) {
-    if (view == NULL) {
-        PyErr_SetString (PyExc_ValueError, "NULL view in getbuffer");
+static int sprite_setopacity (dispmanxSprite *self, PyObject *value, void *closure) {
+    if (value == NULL || !PyLong_Check (value)) {
+        PyErr_SetString(PyExc_TypeError, "opacity must be an int");
+        return -1;
+    }
+    long opacity = PyLong_AsLong (value);
+    if (opacity < 0 || opacity > 255) {
+        if (!PyErr_Occurred ()) {
+            PyErr_SetString(PyExc_ValueError, "opacity must be between 0 and 255");
+        }
+        return -1;
+    }
+    if (!checkSprite (self)) {
         return -1;
     }
+    self->sprite.opacity = opacity;
+    changeSprite (self, ELEMENT_CHANGE_OPACITY, false);
+    return 0;
+}
 
-    view->obj = (PyObject *)self;
-    view->buf = (void *)self->imageLayer.image.buffer;
-    view->len = self->imageLayer.image.size/sizeof (char);
-    view->readonly = 0;
-    view->itemsize = sizeof (char);
-    view->format = "c";  // character
-    view->ndim = 1;
-    view->shape = &view->len;
-    view->strides = &view->itemsize; 
-    view->suboffsets = NULL;
-    view->internal = NULL;
+static PyObject *sprite_getatlas (dispmanxSprite *self, void *closure) {
+    if (!checkSprite (self)) {
+        return NULL;
+    }
+    Py_INCREF (self->atlas);
+    return (PyObject *) self->atlas;
+}
 
-    Py_INCREF (self); // need to increase the reference count
-    return 0;
+static PyObject *sprite_getdisplay (dispmanxSprite *self, void *closure) {
+    if (!checkSprite (self)) {
+        return NULL;
+    }
+    Py_INCREF (self->displayObj);
+    return (PyObject *) self->displayObj;
 }
 
-static PyBufferProcs dispmanxLayer_as_buffer = {
-    (getbufferproc)dispmanxLayer_getbuffer,
-    (releasebufferproc)0,
+static PyMethodDef dispmanxSpriteMethods[] = {
+    {"move", (PyCFunction) method_spriteMove, METH_VARARGS | METH_KEYWORDS, "move the sprite to x, y on the screen"},
+    {NULL}
+};
+
+static PyGetSetDef dispmanxSprite_getsetters[] = {
+    {"pos", (getter) sprite_getpos, (setter) sprite_setpos, "top left corner on the screen", NULL},
+    {"size", (getter) sprite_getsize, (setter) sprite_setsize, "size on the screen", NULL},
+    {"frame", (getter) sprite_getframe, (setter) sprite_setframe, "(x, y, width, height) of the atlas shown", NULL},
+    {"layer", (getter) sprite_getlayer, (setter) sprite_setlayer, "layer number, higher layers are shown on top", NULL},
+    {"opacity", (getter) sprite_getopacity, (setter) sprite_setopacity, "opacity of the whole sprite, 0 to 255", NULL},
+    {"atlas", (getter) sprite_getatlas, NULL, "Atlas the frame is taken from", NULL},
+    {"display", (getter) sprite_getdisplay, NULL, "shared Display object the sprite is shown on", NULL},
+    {NULL}  /* Sentinel */
 };
 
 // object definition
-static PyTypeObject dispmanxLayerType = {
+static PyTypeObject dispmanxSpriteType = {
     PyVarObject_HEAD_INIT (NULL, 0)
-    .tp_name = "dispmanx.dispmanxLayer",
-    .tp_doc = "displamanx layer",
-    .tp_basicsize = sizeof (dispmanxLayer),
+    .tp_name = "dispmanx.Sprite",
+    .tp_doc = "element showing part of an atlas, moved without uploading pixels",
+    .tp_basicsize = sizeof (dispmanxSprite),
     .tp_itemsize = 0,
-    .tp_flags = Py_TPFLAGS_DEFAULT || Py_TPFLAGS_BASETYPE,
-    .tp_new = dispmanxLayer_new,
-    .tp_init = (initproc)dispmanxLayer_init,
-    .tp_dealloc = (destructor) dispmanxLayer_dealloc,
-    .tp_members = dispmanxLayer_members,
-    .tp_methods = dispmanxMethods,
-    .tp_getset = dispmanx_getsetters,
-    .tp_as_buffer = &dispmanxLayer_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc) dispmanxSprite_init,
+    .tp_dealloc = (destructor) dispmanxSprite_dealloc,
+    .tp_methods = dispmanxSpriteMethods,
+    .tp_getset = dispmanxSprite_getsetters,
 };
 
+// function to show several layers in one display update
+static PyObject *pydispmanx_commit (PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"layers", "block", NULL};
+    PyObject *layers;
+    int block = 1;
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|p", kwlist, &layers, &block)) {
+        return NULL;
+    }
+    if (!commitLayers (layers, block)) {
+        return NULL;
+    }
+    Py_RETURN_TRUE;
+}
+
+// function to move many sprites in one display update, from a dict or a sequence of (sprite, (x, y)) pairs
+static PyObject *pydispmanx_moveMany (PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"positions", "block", NULL};
+    PyObject *positions;
+    int block = 0;
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "O|p", kwlist, &positions, &block)) {
+        return NULL;
+    }
+    PyObject *items = PyDict_Check (positions) ? PyDict_Items (positions) : positions;
+    if (items == NULL) {
+        return NULL;
+    }
+    PyObject *seq = PySequence_Fast (items, "positions must be a dict or a sequence of (sprite, (x, y)) pairs");
+    if (items != positions) {
+        Py_DECREF (items);
+    }
+    if (seq == NULL) {
+        return NULL;
+    }
+    Py_ssize_t count = PySequence_Fast_GET_SIZE (seq);
+    SPRITE_T *sprites = PyMem_New (SPRITE_T, count > 0 ? count : 1);
+    if (sprites == NULL) {
+        Py_DECREF (seq);
+        return PyErr_NoMemory ();
+    }
+    // update every sprite first so nothing is sent if one pair is bad
+    for (Py_ssize_t i = 0; i < count; i++) {
+        PyObject *pair = PySequence_Tuple (PySequence_Fast_GET_ITEM (seq, i));
+        dispmanxSprite *sprite;
+        int32_t x, y;
+        bool parsed = pair != NULL && PyArg_ParseTuple (pair, "O!(ii)", &dispmanxSpriteType, &sprite, &x, &y) && checkSprite (sprite);
+        Py_XDECREF (pair);
+        if (!parsed) {
+            PyMem_Free (sprites);
+            Py_DECREF (seq);
+            return NULL;
+        }
+        sprite->sprite.dstRect.x = x;
+        sprite->sprite.dstRect.y = y;
+        sprites[i] = sprite->sprite;
+    }
+    if (count > 0) {
+        Py_BEGIN_ALLOW_THREADS
+        waitForUpdatesSprites (1);
+        DISPMANX_UPDATE_HANDLE_T update = vc_dispmanx_update_start (0);
+        for (Py_ssize_t i = 0; i < count; i++) {
+            changeAttributesSprite (&sprites[i], ELEMENT_CHANGE_DEST_RECT, update);
+        }
+        submitUpdateSprites (update, block);
+        Py_END_ALLOW_THREADS
+    }
+    PyMem_Free (sprites);
+    Py_DECREF (seq);
+    Py_RETURN_NONE;
+}
+
 // function to get a list of valid display numbers
 static PyObject *pydispmanx_getDisplays (PyObject *self, void *closure) {
-    bcm_host_init();
     TV_ATTACHED_DEVICES_T devices;
-    if (vc_tv_get_attached_devices(&devices) != -1) {
+    int result;
+    Py_BEGIN_ALLOW_THREADS
+    bcm_host_init();
+    result = vc_tv_get_attached_devices(&devices);
+    Py_END_ALLOW_THREADS
+    if (result != -1) {
         PyObject *pylist, *item;
         pylist = PyList_New(devices.num_attached);
         for(uint32_t i=0; i<devices.num_attached; i++) {
@@ -290,96 +2667,287 @@ static PyObject *pydispmanx_getDisplays (PyObject *self, void *closure) {
     }
 }
 
+// read the cached mode of the default or given display for the module functions, false if there is none
+static bool moduleDisplay (int displayArg, DISPMANX_MODEINFO_T *info, TV_DISPLAY_STATE_T *tvstate, bool *ntsc) {
+    bool found;
+    uint8_t displayId = DEFAULT_DISPLAY;
+    Py_BEGIN_ALLOW_THREADS
+    found = defaultDisplay (&displayId);
+    Py_END_ALLOW_THREADS
+    if (!found) {
+        return false;
+    }
+    dispmanxDisplay *display = getDisplay (displayArg >= 0 ? displayArg : displayId);
+    if (display == NULL) {
+        PyErr_Clear ();
+        return false;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    found = readDisplay (display, info, tvstate, ntsc);
+    Py_END_ALLOW_THREADS
+    Py_DECREF (display);
+    return found;
+}
+
 // function to get the display size directly from the module
 static PyObject *pydispmanx_getDisplaySize (PyObject *self, PyObject *args) {
-    bcm_host_init();
-    uint8_t displayId = DEFAULT_DISPLAY;
-    TV_ATTACHED_DEVICES_T devices;
-    if (vc_tv_get_attached_devices(&devices) != -1 && devices.num_attached > 0) {
-        displayId = devices.display_number[0];
-        if(PyArg_ParseTuple(args, "|b", &displayId)){
-            DISPMANX_DISPLAY_HANDLE_T display = vc_dispmanx_display_open (displayId);
-            if (display!=0) {
-                DISPMANX_MODEINFO_T info;
-                vc_dispmanx_display_get_info (display, &info);
-                TV_DISPLAY_STATE_T tvstate;
-                vc_tv_get_display_state_id( displayId, &tvstate);
-                pixelAspectRatio par = getPixelAspect(&tvstate);
-                vc_dispmanx_display_close (display);
-                return Py_BuildValue ("(ii)", par.displayWidth, info.height);
-            } else {
-                Py_RETURN_FALSE;
-            }
-        } else {
-            Py_RETURN_FALSE;
-        }
-    } else {
+    int displayArg = -1;
+    if (!PyArg_ParseTuple(args, "|i", &displayArg)) {
+        return NULL;
+    }
+    DISPMANX_MODEINFO_T info;
+    TV_DISPLAY_STATE_T tvstate;
+    if (!moduleDisplay (displayArg, &info, &tvstate, NULL)) {
         Py_RETURN_FALSE;
     }
+    pixelAspectRatio par = getPixelAspect(&tvstate);
+    return Py_BuildValue ("(ii)", par.displayWidth, info.height);
 }
 
-// function to get the display size directly from the module
+// function to get the display frame rate directly from the module
 static PyObject *pydispmanx_getFrameRate (PyObject *self, PyObject *args) {
-    bcm_host_init();
+    int displayArg = -1;
+    if (!PyArg_ParseTuple(args, "|i", &displayArg)) {
+        return NULL;
+    }
+    TV_DISPLAY_STATE_T tvstate;
+    bool ntsc;
+    if (!moduleDisplay (displayArg, NULL, &tvstate, &ntsc)) {
+        Py_RETURN_FALSE;
+    }
+    return Py_BuildValue ("f", frameRateOf (&tvstate, ntsc));
+}
+
+// function to get the pixel aspect ratio directly from the module
+static PyObject *pydispmanx_getPixelAspectRatio (PyObject *self, PyObject *args) {
+    int displayArg = -1;
+    if (!PyArg_ParseTuple(args, "|i", &displayArg)) {
+        return NULL;
+    }
+    TV_DISPLAY_STATE_T tvstate;
+    if (!moduleDisplay (displayArg, NULL, &tvstate, NULL)) {
+        Py_RETURN_FALSE;
+    }
+    pixelAspectRatio par = getPixelAspect(&tvstate);
+    return Py_BuildValue ("(ii)", par.parWidth, par.parHeight);
+}
+
+// function to wait for the next vsync, returns (count, timestamp) or None if none came within timeout seconds
+static PyObject *pydispmanx_waitVsync (PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"display", "timeout", NULL};
+    int displayArg = -1;
+    double timeout = 1.0;
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "|id", kwlist, &displayArg, &timeout)) {
+        return NULL;
+    }
+    int status;
+    bool arrived = false;
+    uint64_t count;
+    double time;
+    Py_BEGIN_ALLOW_THREADS
     uint8_t displayId = DEFAULT_DISPLAY;
-    TV_ATTACHED_DEVICES_T devices;
-    if (vc_tv_get_attached_devices(&devices) != -1 && devices.num_attached > 0) {
-        displayId = devices.display_number[0];
-        if(PyArg_ParseTuple(args, "|b", &displayId)){
-            DISPMANX_DISPLAY_HANDLE_T display = vc_dispmanx_display_open (displayId);
-            if (display!=0) {
-                DISPMANX_MODEINFO_T info;
-                vc_dispmanx_display_get_info (display, &info);
-                TV_DISPLAY_STATE_T tvstate;
-                vc_tv_get_display_state_id( displayId, &tvstate);
-                // check if NTSC
-                HDMI_PROPERTY_PARAM_T property;
-                property.property = HDMI_PROPERTY_PIXEL_CLOCK_TYPE;
-                vc_tv_hdmi_get_property_id(displayId, &property);
-                float frameRate = 0;
-                if(property.param1 == HDMI_PIXEL_CLOCK_TYPE_NTSC){
-                    frameRate= tvstate.display.hdmi.frame_rate * (1000.0f/1001.0f);
-                } else {
-                    frameRate = tvstate.display.hdmi.frame_rate;
-                }
-                vc_dispmanx_display_close (display);
-                return Py_BuildValue ("f", frameRate);
-            } else {
-                Py_RETURN_FALSE;
-            }
-        } else {
-            Py_RETURN_FALSE;
+    defaultDisplay (&displayId);
+    if (displayArg >= 0) {
+        displayId = displayArg;
+    }
+    status = holdVsync (displayId);
+    if (status == VSYNC_OK) {
+        lastVsync (&count, &time);
+        arrived = nextVsync (count, timeout, &count, &time);
+        releaseVsync ();
+    }
+    Py_END_ALLOW_THREADS
+    if (!checkVsync (status)) {
+        return NULL;
+    }
+    if (!arrived) {
+        Py_RETURN_NONE;
+    }
+    return Py_BuildValue ("(Kd)", (unsigned long long) count, time);
+}
+
+// async for over the iterator yields (count, timestamp) for each vsync, vsyncs missed while the loop
+// was busy are folded into the next one
+static PyObject *vsyncEvents_anext (dispmanxVsyncEvents *self) {
+    PyObject *future = asyncFuture ();
+    if (future == NULL) {
+        return NULL;
+    }
+    if (vsyncWaiters == NULL) {
+        vsyncWaiters = PyList_New (0);
+        if (vsyncWaiters == NULL) {
+            Py_DECREF (future);
+            return NULL;
         }
-    } else {
-        Py_RETURN_FALSE;
     }
+    PyObject *waiter = Py_BuildValue ("[OO]", self, future);
+    if (waiter == NULL || PyList_Append (vsyncWaiters, waiter) < 0) {
+        Py_XDECREF (waiter);
+        Py_DECREF (future);
+        return NULL;
+    }
+    Py_DECREF (waiter);
+    pumpAsync ();
+    return future;
 }
 
+static void vsyncEvents_dealloc (dispmanxVsyncEvents *self) {
+    Py_BEGIN_ALLOW_THREADS
+    releaseVsync ();
+    Py_END_ALLOW_THREADS
+    PyObject_Free (self);
+}
 
+static PyObject *vsyncEvents_aiter (PyObject *self) {
+    Py_INCREF (self);
+    return self;
+}
 
-// function to get the pixel aspect ratio directly from the module
-static PyObject *pydispmanx_getPixelAspectRatio (PyObject *self, PyObject *args) {
-    bcm_host_init();
+static PyAsyncMethods vsyncEvents_as_async = {
+    .am_aiter = (unaryfunc) vsyncEvents_aiter,
+    .am_anext = (unaryfunc) vsyncEvents_anext,
+};
+
+// object definition
+static PyTypeObject dispmanxVsyncEventsType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    .tp_name = "dispmanx.VsyncEvents",
+    .tp_doc = "async iterator over the vsyncs of a display",
+    .tp_basicsize = sizeof (dispmanxVsyncEvents),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) vsyncEvents_dealloc,
+    .tp_as_async = &vsyncEvents_as_async,
+};
+
+// function returning an async iterator over the vsyncs of a display, starting with the next one
+static PyObject *pydispmanx_vsyncEvents (PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"display", NULL};
+    int displayArg = -1;
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "|i", kwlist, &displayArg)) {
+        return NULL;
+    }
+    int status;
+    uint64_t count = 0;
+    double time;
+    Py_BEGIN_ALLOW_THREADS
     uint8_t displayId = DEFAULT_DISPLAY;
-    TV_ATTACHED_DEVICES_T devices;
-    if (vc_tv_get_attached_devices(&devices) != -1 && devices.num_attached > 0) {
-        displayId = devices.display_number[0];
-        if(PyArg_ParseTuple(args, "|b", &displayId)){
-            DISPMANX_DISPLAY_HANDLE_T display = vc_dispmanx_display_open (displayId);
-            if (display!=0) {
-                TV_DISPLAY_STATE_T tvstate;
-                vc_tv_get_display_state_id( displayId, &tvstate);
-                pixelAspectRatio par = getPixelAspect(&tvstate);
-                return Py_BuildValue ("(ii)", par.parWidth, par.parHeight);
-            } else {
-                Py_RETURN_FALSE;
-            }
-        } else {
-            Py_RETURN_FALSE;
+    defaultDisplay (&displayId);
+    if (displayArg >= 0) {
+        displayId = displayArg;
+    }
+    status = holdVsync (displayId);
+    if (status == VSYNC_OK) {
+        lastVsync (&count, &time);
+    }
+    Py_END_ALLOW_THREADS
+    if (!checkVsync (status)) {
+        return NULL;
+    }
+    // the iterator holds the vsync source until it is deleted
+    dispmanxVsyncEvents *events = PyObject_New (dispmanxVsyncEvents, &dispmanxVsyncEventsType);
+    if (events == NULL) {
+        Py_BEGIN_ALLOW_THREADS
+        releaseVsync ();
+        Py_END_ALLOW_THREADS
+        return NULL;
+    }
+    events->seen = count;
+    return (PyObject *) events;
+}
+
+// function to read the vsync counter and the time.monotonic() of the last vsync without waiting
+static PyObject *pydispmanx_getVsync (PyObject *self, PyObject *args) {
+    uint64_t count;
+    double time;
+    lastVsync (&count, &time);
+    return Py_BuildValue ("(Kd)", (unsigned long long) count, time);
+}
+
+// function to total the counters of every layer, including ones already deleted
+static PyObject *pydispmanx_stats (PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"reset", NULL};
+    int reset = 0;
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "|p", kwlist, &reset)) {
+        return NULL;
+    }
+    // hold the layers, taking their locks can let other threads delete them
+    PyObject *layers = PyList_New (0);
+    if (layers == NULL) {
+        return NULL;
+    }
+    for (PyObject *layer = liveLayers; layer != NULL; layer = ((dispmanxLayer *) layer)->nextLayer) {
+        if (PyList_Append (layers, layer) < 0) {
+            Py_DECREF (layers);
+            return NULL;
         }
-    } else {
-         Py_RETURN_FALSE;
     }
+    IMAGE_LAYER_STATS_T total = retiredStats;
+    Py_ssize_t exports = 0;
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE (layers); i++) {
+        dispmanxLayer *l = (dispmanxLayer *) PyList_GET_ITEM (layers, i);
+        IMAGE_LAYER_STATS_T stats;
+        lockLayer (l);
+        getStatsImageLayer (& (l->imageLayer), &stats);
+        if (reset) {
+            resetStatsImageLayer (& (l->imageLayer));
+        }
+        PyThread_release_lock (l->lock);
+        addStatsImageLayer (&total, &stats);
+        exports += l->exports;
+    }
+    Py_DECREF (layers);
+    if (reset) {
+        memset (&retiredStats, 0, sizeof (retiredStats));
+    }
+    return statsDict (&total, exports);
+}
+
+// function to set how many bytes of freed resources and buffers are kept for reuse, trimming the pool to fit
+static PyObject *pydispmanx_setPoolLimit (PyObject *self, PyObject *args) {
+    long long limit;
+    if (!PyArg_ParseTuple (args, "L", &limit)) {
+        return NULL;
+    }
+    if (limit < 0) {
+        PyErr_SetString(PyExc_ValueError, "limit must not be negative");
+        return NULL;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    setLimitPool (limit);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+// function to free pooled resources and buffers, oldest first, until at most bytes are kept
+static PyObject *pydispmanx_trimPool (PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"bytes", NULL};
+    long long bytes = 0;
+    if (!PyArg_ParseTupleAndKeywords (args, kwds, "|L", kwlist, &bytes)) {
+        return NULL;
+    }
+    if (bytes < 0) {
+        PyErr_SetString(PyExc_ValueError, "bytes must not be negative");
+        return NULL;
+    }
+    uint64_t freed;
+    Py_BEGIN_ALLOW_THREADS
+    freed = trimPool (bytes);
+    Py_END_ALLOW_THREADS
+    return PyLong_FromUnsignedLongLong (freed);
+}
+
+// function to get what the pool holds and how often it was used
+static PyObject *pydispmanx_poolStats (PyObject *self, PyObject *args) {
+    POOL_STATS_T stats;
+    getStatsPool (&stats);
+    return Py_BuildValue ("{s:I,s:I,s:K,s:K,s:K,s:K}",
+                          "resources", stats.resources,
+                          "buffers", stats.buffers,
+                          "bytes", (unsigned long long) stats.bytes,
+                          "limit", (unsigned long long) stats.limit,
+                          "hits", (unsigned long long) stats.hits,
+                          "misses", (unsigned long long) stats.misses);
 }
 
 static PyMethodDef pydispmanxMethods[] = {
@@ -387,6 +2955,15 @@ static PyMethodDef pydispmanxMethods[] = {
     {"getDisplaySize", (PyCFunction) pydispmanx_getDisplaySize, METH_VARARGS, "Get the display size as a tuple"},
     {"getFrameRate", (PyCFunction) pydispmanx_getFrameRate, METH_VARARGS, "Get the display frame rate"},
     {"getPixelAspectRatio", (PyCFunction) pydispmanx_getPixelAspectRatio, METH_VARARGS, "Get the pixel aspect ratio as a tuple"},
+    {"commit", (PyCFunction) pydispmanx_commit, METH_VARARGS | METH_KEYWORDS, "Show a sequence of layers in a single display update"},
+    {"moveMany", (PyCFunction) pydispmanx_moveMany, METH_VARARGS | METH_KEYWORDS, "Move sprites in a single display update, from a dict or sequence of (sprite, (x, y)) pairs"},
+    {"waitVsync", (PyCFunction) pydispmanx_waitVsync, METH_VARARGS | METH_KEYWORDS, "Wait for the next vsync and return (count, timestamp), or None after timeout seconds"},
+    {"getVsync", (PyCFunction) pydispmanx_getVsync, METH_NOARGS, "Return (count, timestamp) of the last vsync seen"},
+    {"vsyncEvents", (PyCFunction) pydispmanx_vsyncEvents, METH_VARARGS | METH_KEYWORDS, "Return an async iterator yielding (count, timestamp) for every vsync"},
+    {"stats", (PyCFunction) pydispmanx_stats, METH_VARARGS | METH_KEYWORDS, "Return the counters of all layers added together, reset=True clears them"},
+    {"setPoolLimit", (PyCFunction) pydispmanx_setPoolLimit, METH_VARARGS, "Keep up to this many bytes of freed GPU resources and buffers for reuse"},
+    {"trimPool", (PyCFunction) pydispmanx_trimPool, METH_VARARGS | METH_KEYWORDS, "Free pooled resources and buffers until at most bytes are kept, return the bytes freed"},
+    {"poolStats", (PyCFunction) pydispmanx_poolStats, METH_NOARGS, "Return what the resource pool holds and its hit and miss counts"},
     {NULL}
 };
 
@@ -404,6 +2981,21 @@ PyMODINIT_FUNC PyInit_pydispmanx (void) {
     if (PyType_Ready (&dispmanxLayerType) < 0) {
         return NULL;
     }
+    if (PyType_Ready (&dispmanxUpdateType) < 0) {
+        return NULL;
+    }
+    if (PyType_Ready (&dispmanxDisplayType) < 0) {
+        return NULL;
+    }
+    if (PyType_Ready (&dispmanxVsyncEventsType) < 0) {
+        return NULL;
+    }
+    if (PyType_Ready (&dispmanxAtlasType) < 0) {
+        return NULL;
+    }
+    if (PyType_Ready (&dispmanxSpriteType) < 0) {
+        return NULL;
+    }
 
     m=PyModule_Create (&dispmanxModule);
     if (m == NULL) {
@@ -416,5 +3008,44 @@ PyMODINIT_FUNC PyInit_pydispmanx (void) {
         Py_DECREF (m);
         return NULL;
     }
+
+    Py_INCREF (&dispmanxUpdateType);
+    if (PyModule_AddObject (m, "Update", (PyObject *) &dispmanxUpdateType) < 0) {
+        Py_DECREF (&dispmanxUpdateType);
+        Py_DECREF (m);
+        return NULL;
+    }
+
+    Py_INCREF (&dispmanxDisplayType);
+    if (PyModule_AddObject (m, "Display", (PyObject *) &dispmanxDisplayType) < 0) {
+        Py_DECREF (&dispmanxDisplayType);
+        Py_DECREF (m);
+        return NULL;
+    }
+
+    Py_INCREF (&dispmanxAtlasType);
+    if (PyModule_AddObject (m, "Atlas", (PyObject *) &dispmanxAtlasType) < 0) {
+        Py_DECREF (&dispmanxAtlasType);
+        Py_DECREF (m);
+        return NULL;
+    }
+
+    Py_INCREF (&dispmanxSpriteType);
+    if (PyModule_AddObject (m, "Sprite", (PyObject *) &dispmanxSpriteType) < 0) {
+        Py_DECREF (&dispmanxSpriteType);
+        Py_DECREF (m);
+        return NULL;
+    }
+
+    // layer transforms, the flips can be or'd with any rotation
+    if (PyModule_AddIntConstant (m, "ROTATE_0", DISPMANX_NO_ROTATE) < 0 ||
+        PyModule_AddIntConstant (m, "ROTATE_90", DISPMANX_ROTATE_90) < 0 ||
+        PyModule_AddIntConstant (m, "ROTATE_180", DISPMANX_ROTATE_180) < 0 ||
+        PyModule_AddIntConstant (m, "ROTATE_270", DISPMANX_ROTATE_270) < 0 ||
+        PyModule_AddIntConstant (m, "FLIP_HORIZONTAL", DISPMANX_FLIP_HRIZ) < 0 ||
+        PyModule_AddIntConstant (m, "FLIP_VERTICAL", DISPMANX_FLIP_VERT) < 0) {
+        Py_DECREF (m);
+        return NULL;
+    }
     return m;
 }
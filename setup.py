@@ -1,7 +1,12 @@
+import os
 from distutils.core import setup, Extension
 
-# define the pydispmanx extension module
-pydispmanx = Extension('pydispmanx', sources=['pydispmanx.c', 'image.c', 'imageLayer.c'], library_dirs=['/opt/vc/lib'], libraries=['bcm_host'], include_dirs=['/opt/vc/include', '/opt/vc/include/interface/vcos/pthreads', '/opt/vc/includes/interface/vmcs_host/linnux'])
+# PYDISPMANX_BACKEND=host builds against the in-memory dispmanx in host/ so the module can run without a Raspberry Pi GPU
+if os.environ.get('PYDISPMANX_BACKEND') == 'host':
+    pydispmanx = Extension('pydispmanx', sources=['pydispmanx.c', 'image.c', 'imageLayer.c', 'spriteLayer.c', 'pool.c', 'host/bcm_host.c'], libraries=['pthread'], include_dirs=['host'])
+else:
+    # define the pydispmanx extension module
+    pydispmanx = Extension('pydispmanx', sources=['pydispmanx.c', 'image.c', 'imageLayer.c', 'spriteLayer.c', 'pool.c'], library_dirs=['/opt/vc/lib'], libraries=['bcm_host', 'vcsm'], include_dirs=['/opt/vc/include', '/opt/vc/include/interface/vcsm', '/opt/vc/include/interface/vcos/pthreads', '/opt/vc/includes/interface/vmcs_host/linnux'])
 
 # run the setup
 setup(
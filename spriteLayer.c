@@ -0,0 +1,251 @@
+//-------------------------------------------------------------------------
+//
+// The MIT License (MIT)
+//
+// Copyright (c) 2013 Andrew Duncan
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//-------------------------------------------------------------------------
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "element_change.h"
+#include "image.h"
+#include "pool.h"
+#include "spriteLayer.h"
+
+//-------------------------------------------------------------------------
+
+// updates that only touch sprites are counted together, so code moving
+// many sprites every frame can keep at most one update queued
+
+static pthread_mutex_t pendingLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pendingDone = PTHREAD_COND_INITIALIZER;
+static int32_t pendingUpdates = 0;
+
+//-------------------------------------------------------------------------
+// A pooled resource still holds the pixels of whatever used it last and a
+// new one is undefined, so the cleared image is written over it. Atlases
+// have no palette of their own, only direct colour types can be used.
+
+bool
+initSpriteAtlas(
+    SPRITE_ATLAS_T *atlas,
+    VC_IMAGE_TYPE_T type,
+    int32_t width,
+    int32_t height)
+{
+    if (initImagePool(&(atlas->image), type, width, height, false) == false)
+    {
+        return false;
+    }
+
+    atlas->resource = takeResourcePool(&(atlas->image));
+
+    VC_RECT_T all;
+    vc_dispmanx_rect_set(&all, 0, 0, width, height);
+    uploadSpriteAtlas(atlas, &all);
+
+    return true;
+}
+
+//-------------------------------------------------------------------------
+// Write the rows covered by rect to the resource. Sprites already showing
+// the atlas pick up the new pixels straight away.
+
+void
+uploadSpriteAtlas(
+    SPRITE_ATLAS_T *atlas,
+    const VC_RECT_T *rect)
+{
+    int32_t top = (rect->y < 0) ? 0 : rect->y;
+    int32_t bottom = rect->y + rect->height;
+
+    if (bottom > atlas->image.height)
+    {
+        bottom = atlas->image.height;
+    }
+
+    if (bottom <= top)
+    {
+        return;
+    }
+
+    VC_RECT_T rows;
+    vc_dispmanx_rect_set(&rows, 0, top, atlas->image.width, bottom - top);
+
+    int result = vc_dispmanx_resource_write_data(atlas->resource,
+                                                 atlas->image.type,
+                                                 atlas->image.pitch,
+                                                 atlas->image.buffer,
+                                                 &rows);
+    assert(result == 0);
+}
+
+//-------------------------------------------------------------------------
+// Wait for queued sprite updates, the removal of the atlas's last sprites
+// among them, before deleting the resource.
+
+void
+destroySpriteAtlas(
+    SPRITE_ATLAS_T *atlas)
+{
+    waitForUpdatesSprites(0);
+
+    giveResourcePool(&(atlas->image), atlas->resource);
+    destroyImagePool(&(atlas->image));
+}
+
+//-------------------------------------------------------------------------
+// Show the frame, in atlas pixels, of the sprite's atlas.
+
+void
+setFrameSprite(
+    SPRITE_T *sprite,
+    const VC_RECT_T *frame)
+{
+    vc_dispmanx_rect_set(&(sprite->srcRect),
+                         frame->x << 16,
+                         frame->y << 16,
+                         frame->width << 16,
+                         frame->height << 16);
+}
+
+//-------------------------------------------------------------------------
+
+void
+addElementSprite(
+    SPRITE_T *sprite,
+    SPRITE_ATLAS_T *atlas,
+    DISPMANX_DISPLAY_HANDLE_T display,
+    DISPMANX_UPDATE_HANDLE_T update)
+{
+    // mix so the element opacity scales the per pixel alpha
+
+    VC_DISPMANX_ALPHA_T alpha =
+    {
+        DISPMANX_FLAGS_ALPHA_FROM_SOURCE | DISPMANX_FLAGS_ALPHA_MIX,
+        sprite->opacity, /*alpha 0->255*/
+        0
+    };
+
+    sprite->resource = atlas->resource;
+    sprite->element =
+        vc_dispmanx_element_add(update,
+                                display,
+                                sprite->layer,
+                                &(sprite->dstRect),
+                                sprite->resource,
+                                &(sprite->srcRect),
+                                DISPMANX_PROTECTION_NONE,
+                                &alpha,
+                                NULL, // clamp
+                                DISPMANX_NO_ROTATE);
+    assert(sprite->element != 0);
+}
+
+//-------------------------------------------------------------------------
+// Send the layer, opacity and rectangles selected by the ELEMENT_CHANGE_*
+// flags to the sprite's element.
+
+void
+changeAttributesSprite(
+    const SPRITE_T *sprite,
+    uint32_t changeFlags,
+    DISPMANX_UPDATE_HANDLE_T update)
+{
+    int result =
+    vc_dispmanx_element_change_attributes(update,
+                                          sprite->element,
+                                          changeFlags,
+                                          sprite->layer,
+                                          sprite->opacity,
+                                          &(sprite->dstRect),
+                                          &(sprite->srcRect),
+                                          0,
+                                          DISPMANX_NO_ROTATE);
+    assert(result == 0);
+}
+
+//-------------------------------------------------------------------------
+
+void
+removeSprite(
+    SPRITE_T *sprite,
+    DISPMANX_UPDATE_HANDLE_T update)
+{
+    int result = vc_dispmanx_element_remove(update, sprite->element);
+    assert(result == 0);
+
+    sprite->element = 0;
+}
+
+//-------------------------------------------------------------------------
+
+static void
+updateDoneSprites(
+    DISPMANX_UPDATE_HANDLE_T update,
+    void *arg)
+{
+    pthread_mutex_lock(&pendingLock);
+    pendingUpdates--;
+    pthread_cond_broadcast(&pendingDone);
+    pthread_mutex_unlock(&pendingLock);
+}
+
+//-------------------------------------------------------------------------
+
+void
+submitUpdateSprites(
+    DISPMANX_UPDATE_HANDLE_T update,
+    bool wait)
+{
+    pthread_mutex_lock(&pendingLock);
+    pendingUpdates++;
+    pthread_mutex_unlock(&pendingLock);
+
+    int result = vc_dispmanx_update_submit(update, updateDoneSprites, NULL);
+    assert(result == 0);
+
+    if (wait)
+    {
+        waitForUpdatesSprites(0);
+    }
+}
+
+//-------------------------------------------------------------------------
+
+void
+waitForUpdatesSprites(
+    int32_t maxPending)
+{
+    pthread_mutex_lock(&pendingLock);
+
+    while (pendingUpdates > maxPending)
+    {
+        pthread_cond_wait(&pendingDone, &pendingLock);
+    }
+
+    pthread_mutex_unlock(&pendingLock);
+}
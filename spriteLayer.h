@@ -0,0 +1,111 @@
+//-------------------------------------------------------------------------
+//
+// The MIT License (MIT)
+//
+// Copyright (c) 2013 Andrew Duncan
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//-------------------------------------------------------------------------
+
+#ifndef SPRITE_LAYER_H
+#define SPRITE_LAYER_H
+
+#include <stdbool.h>
+
+#include "image.h"
+
+#include "bcm_host.h"
+
+//-------------------------------------------------------------------------
+
+// An atlas is an image uploaded once into a single resource. Sprites are
+// elements that each show part of an atlas, so moving or animating them
+// only changes element attributes and never transfers pixels.
+
+typedef struct
+{
+    IMAGE_T image;
+    DISPMANX_RESOURCE_HANDLE_T resource;
+} SPRITE_ATLAS_T;
+
+typedef struct
+{
+    VC_RECT_T srcRect;
+    VC_RECT_T dstRect;
+    int32_t layer;
+    uint8_t opacity;
+    DISPMANX_RESOURCE_HANDLE_T resource;
+    DISPMANX_ELEMENT_HANDLE_T element;
+} SPRITE_T;
+
+//-------------------------------------------------------------------------
+
+bool
+initSpriteAtlas(
+    SPRITE_ATLAS_T *atlas,
+    VC_IMAGE_TYPE_T type,
+    int32_t width,
+    int32_t height);
+
+void
+uploadSpriteAtlas(
+    SPRITE_ATLAS_T *atlas,
+    const VC_RECT_T *rect);
+
+void
+destroySpriteAtlas(
+    SPRITE_ATLAS_T *atlas);
+
+void
+setFrameSprite(
+    SPRITE_T *sprite,
+    const VC_RECT_T *frame);
+
+void
+addElementSprite(
+    SPRITE_T *sprite,
+    SPRITE_ATLAS_T *atlas,
+    DISPMANX_DISPLAY_HANDLE_T display,
+    DISPMANX_UPDATE_HANDLE_T update);
+
+void
+changeAttributesSprite(
+    const SPRITE_T *sprite,
+    uint32_t changeFlags,
+    DISPMANX_UPDATE_HANDLE_T update);
+
+void
+removeSprite(
+    SPRITE_T *sprite,
+    DISPMANX_UPDATE_HANDLE_T update);
+
+void
+submitUpdateSprites(
+    DISPMANX_UPDATE_HANDLE_T update,
+    bool wait);
+
+void
+waitForUpdatesSprites(
+    int32_t maxPending);
+
+//-------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+# Checks what reaches the screen against the layer buffer, using the frames
+# the host backend dumps after every update.
+#
+#   PYDISPMANX_BACKEND=host python3 setup.py build_ext --inplace
+#   python3 test/hostTest.py
+#
+# Every update is applied at once and the display is small, so it runs in
+# a few seconds.
+
+import os, sys, tempfile, time, unittest
+
+testDir = os.path.dirname(os.path.abspath(__file__))
+rootDir = os.path.dirname(testDir)
+dumpDir = tempfile.TemporaryDirectory()
+
+WIDTH, HEIGHT = 64, 48
+os.environ["PYDISPMANX_HOST_MODE"] = "%dx%d@0" % (WIDTH, HEIGHT)
+os.environ["PYDISPMANX_HOST_DUMP"] = os.path.join(dumpDir.name, "frame%08d.ppm")
+
+sys.path.insert(0, rootDir)
+import pydispmanx
+
+# the last frame the backend wrote, as RGB rows
+def lastFrame():
+    name = max(os.listdir(dumpDir.name))
+    with open(os.path.join(dumpDir.name, name), "rb") as f:
+        data = f.read()
+    header = b"P6\n%d %d\n255\n" % (WIDTH, HEIGHT)
+    assert data.startswith(header)
+    return data[len(header):]
+
+def frameCount():
+    return len(os.listdir(dumpDir.name))
+
+# the RGB a full screen RGBA32 layer with an opaque buffer should show
+def bufferRGB(layer):
+    with memoryview(layer) as view:
+        data = view.cast("B")
+        return b"".join(data[i:i + 3] for i in range(0, WIDTH * HEIGHT * 4, 4))
+
+# fill rows top to bottom of an RGBA32 layer with a pattern that differs per row, column and seed
+def paint(layer, top, bottom, seed):
+    with memoryview(layer) as view:
+        data = view.cast("B")
+        for y in range(top, bottom):
+            row = bytes(c for x in range(WIDTH) for c in ((x * 4 + seed) & 255, (y * 5 + seed) & 255, (x + y + seed * 3) & 255, 255))
+            data[y * WIDTH * 4:(y + 1) * WIDTH * 4] = row
+
+def rowsOf(rgb, top, bottom):
+    return rgb[top * WIDTH * 3:bottom * WIDTH * 3]
+
+class HostTest(unittest.TestCase):
+    def assertShows(self, expected, tolerance=0):
+        frame = lastFrame()
+        self.assertEqual(len(frame), len(expected))
+        if tolerance == 0:
+            for y in range(HEIGHT):
+                self.assertEqual(rowsOf(frame, y, y + 1), rowsOf(expected, y, y + 1), "row %d" % y)
+        else:
+            worst = max(abs(a - b) for a, b in zip(frame, expected))
+            self.assertLessEqual(worst, tolerance)
+
+    def test_whole_update(self):
+        layer = pydispmanx.dispmanxLayer(1)
+        paint(layer, 0, HEIGHT, 1)
+        layer.updateLayer()
+        self.assertShows(bufferRGB(layer))
+
+    def test_dirty_bands(self):
+        # with one resource the rows outside the rectangles are never written
+        layer = pydispmanx.dispmanxLayer(1, buffers=1)
+        paint(layer, 0, HEIGHT, 2)
+        layer.updateLayer()
+        shown = bufferRGB(layer)
+        paint(layer, 0, HEIGHT, 3)
+        layer.updateLayer((4, 5, 10, 6), (0, 30, WIDTH, 3))
+        current = bufferRGB(layer)
+        expected = rowsOf(shown, 0, 5) + rowsOf(current, 5, 11) + rowsOf(shown, 11, 30) + rowsOf(current, 30, 33) + rowsOf(shown, 33, HEIGHT)
+        self.assertShows(expected)
+
+    def test_buffers(self):
+        # each resource must catch up with the rows changed while it was off screen
+        for buffers in (1, 2, 3):
+            layer = pydispmanx.dispmanxLayer(1, buffers=buffers)
+            paint(layer, 0, HEIGHT, 4)
+            layer.updateLayer()
+            for i in range(7):
+                top = (i * 7) % (HEIGHT - 4)
+                paint(layer, top, top + 4, 10 + i)
+                layer.updateLayer((0, top, WIDTH, 4))
+                self.assertShows(bufferRGB(layer))
+            del layer
+
+    def test_conversion(self):
+        # dithering moves each channel by less than two RGB565 steps
+        layer = pydispmanx.dispmanxLayer(1, upload="RGB565")
+        paint(layer, 0, HEIGHT, 20)
+        layer.updateLayer()
+        for i in range(1, 3):
+            paint(layer, i * 8, i * 8 + 8, 20 + i)
+            layer.updateLayer((0, i * 8, WIDTH, 8))
+        self.assertShows(bufferRGB(layer), tolerance=16)
+
+    def test_pipeline(self):
+        layer = pydispmanx.dispmanxLayer(1, pipeline=True)
+        paint(layer, 0, HEIGHT, 30)
+        layer.updateLayer()
+        for i in range(6):
+            top = (i * 11) % (HEIGHT - 3)
+            paint(layer, top, top + 3, 31 + i)
+            presented = layer.stats()["framesPresented"]
+            layer.updateLayer((0, top, WIDTH, 3))
+            deadline = time.monotonic() + 2
+            while layer.stats()["framesPresented"] == presented and time.monotonic() < deadline:
+                time.sleep(0.001)
+            self.assertShows(bufferRGB(layer))
+
+    def test_change_detection(self):
+        layer = pydispmanx.dispmanxLayer(1, detectChanges=True)
+        paint(layer, 0, HEIGHT, 40)
+        layer.updateLayer()
+        paint(layer, 20, 23, 41)
+        layer.updateLayer()
+        self.assertShows(bufferRGB(layer))
+        # nothing changed, so nothing is sent
+        frames = frameCount()
+        layer.updateLayer()
+        self.assertEqual(frameCount(), frames)
+        self.assertEqual(layer.stats()["framesSkipped"], 1)
+
+    def test_shared(self):
+        layer = pydispmanx.dispmanxLayer(1, shared=True)
+        paint(layer, 0, HEIGHT, 50)
+        layer.updateLayer()
+        paint(layer, 10, 20, 51)
+        layer.updateLayer((0, 10, WIDTH, 10))
+        self.assertShows(bufferRGB(layer))
+
+    def test_palette(self):
+        colours = [(0, 0, 0), (255, 0, 0), (0, 255, 0), (0, 0, 255), (255, 255, 255)]
+        layer = pydispmanx.dispmanxLayer(1, format="8BPP")
+        layer.setPalette(colours)
+        for y in range(0, HEIGHT, 8):
+            layer.fillRect((0, y, WIDTH, 8), (y // 8) % len(colours))
+        layer.updateLayer()
+        expected = b"".join(bytes(colours[(y // 8) % len(colours)]) * WIDTH for y in range(HEIGHT))
+        self.assertShows(expected)
+        # a palette change shows without uploading the pixels again
+        layer.setPalette([(255, 255, 0)], start=1)
+        layer.move(0, 0, block=True)
+        colours[1] = (255, 255, 0)
+        expected = b"".join(bytes(colours[(y // 8) % len(colours)]) * WIDTH for y in range(HEIGHT))
+        self.assertShows(expected)
+
+if __name__ == "__main__":
+    unittest.main()